@@ -5,6 +5,7 @@
 #include <chrono>
 #include "vector.h"
 #include "body.h"
+#include "simulation.h"
 #include "util.h"
 
 #define ITERS 10000
@@ -14,49 +15,33 @@
 int main(int argc, char* argv[])
 {
     int N;
-    Body *bodies, *bodies_new;
-    read_input(&N, &bodies, &bodies_new);
+    Body *bodies;
+    read_input(&N, &bodies);
 
     Vector* log = new Vector[N * FRAMES * 2];
 
-    auto time_start = std::chrono::steady_clock::now();
-
-    int frame = 0;
-    for (int iter = 0; iter < ITERS; ++iter)
-    {
-
-        for (int i = 0; i < N; ++i)
-        {
-            Vector accel_sum = Vector();
-            for (int j = 0; j < N; ++j)
-            {   
-                if (i != j)
-                {
-                    accel_sum += bodies[i].acceleration(bodies[j]);
-                }
-            }
-
-            bodies_new[i].pos = bodies[i].pos + bodies[i].vel * DELTA_T + accel_sum * (0.5 * DELTA_T * DELTA_T);
-            bodies_new[i].vel = bodies[i].vel + accel_sum * DELTA_T;
+    Simulation sim(N, bodies);
+    sim.set_solver(Solver::DIRECT_FIXED);
+    sim.set_delta_t(DELTA_T);
+    sim.set_frame_callback(ITERS / FRAMES, [&](Simulation &sim, int frame) {
+        for (int i = 0; i < N; ++i) {
+            log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies[i].pos);
+            log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies[i].vel);
         }
+    });
 
-        if (iter % (ITERS / FRAMES) == 0) {
-            for (int i = 0; i < N; ++i) {
-                log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies_new[i].pos);
-                log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies_new[i].vel);
-            }
-            ++frame;
-        }
+    auto time_start = std::chrono::steady_clock::now();
 
-        Body* tmp = bodies_new;
-        bodies_new = bodies;
-        bodies = tmp;
-    }
+    sim.step(ITERS);
 
     auto time_end = std::chrono::steady_clock::now();
     double time = std::chrono::duration<double>(time_end - time_start).count();
 
+#ifdef BINARY_OUTPUT
+    write_output_binary(N, FRAMES, log, bodies);
+#else
     write_output(N, FRAMES, log, bodies);
+#endif
 
     printf("Required time: %lfs\n", time);
 }
@@ -0,0 +1,88 @@
+// Ensemble of many small independent systems, see ensemble.h
+//
+// Usage: N_body_ensemble              systems from data/input_ensemble.txt
+//        N_body_ensemble S [eps]      S copies of data/input.txt, positions of all
+//                                     but the first perturbed by a relative eps
+// Every member is written to data/output_<member>.txt
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <random>
+#include <chrono>
+#include "vector.h"
+#include "body.h"
+#include "ensemble.h"
+#include "util.h"
+
+#define ITERS 10000
+#define DELTA_T 100000.0
+#define FRAMES 200
+
+#define PERTURBATION 1e-6
+
+int main(int argc, char* argv[])
+{
+    int S, N;
+    Body* bodies;
+
+    if (argc > 1) {
+        Body* base;
+        read_input(&N, &base);
+        S = atoi(argv[1]);
+        double eps = (argc > 2) ? atof(argv[2]) : PERTURBATION;
+
+        bodies = new Body[S * N];
+        for (int s = 0; s < S; ++s) {
+            std::mt19937_64 rng(s);
+            std::uniform_real_distribution<double> perturbation(-eps, eps);
+            for (int i = 0; i < N; ++i) {
+                Body b = base[i];
+                if (s > 0) {
+                    b.pos.x *= 1.0 + perturbation(rng);
+                    b.pos.y *= 1.0 + perturbation(rng);
+                    b.pos.z *= 1.0 + perturbation(rng);
+                }
+                bodies[s * N + i] = b;
+            }
+        }
+    } else if (!read_ensemble(&S, &N, &bodies)) {
+        printf("Could not read data/input_ensemble.txt\n");
+        return 1;
+    }
+
+    Ensemble ensemble(S, N, bodies);
+    Vector* log = new Vector[(long long)S * N * FRAMES * 2];
+
+    auto time_start = std::chrono::steady_clock::now();
+
+    ensemble.run(ITERS, DELTA_T, ITERS / FRAMES, [&](Ensemble &e, int s0, int s1, int frame) {
+        for (int s = s0; s < s1; ++s) {
+            Vector* my_log = log + (long long)s * N * FRAMES * 2;
+            for (int i = 0; i < N; ++i) {
+                Body b = e.get_body(s, i);
+                my_log[(i * FRAMES + frame) * 2 + 0] = b.pos;
+                my_log[(i * FRAMES + frame) * 2 + 1] = b.vel;
+            }
+        }
+    });
+
+    auto time_end = std::chrono::steady_clock::now();
+    double time = std::chrono::duration<double>(time_end - time_start).count();
+
+    for (int s = 0; s < S; ++s) {
+        Body* my_bodies = bodies + (long long)s * N;
+        Vector* my_log = log + (long long)s * N * FRAMES * 2;
+#ifdef BINARY_OUTPUT
+        std::string path = "data/output_" + std::to_string(s) + ".bin";
+        write_output_binary(N, FRAMES, my_log, my_bodies, path.c_str());
+#else
+        std::string path = "data/output_" + std::to_string(s) + ".txt";
+        write_output(N, FRAMES, my_log, my_bodies, path.c_str());
+#endif
+    }
+
+    printf("Required time: %lfs\n", time);
+    printf("Throughput:    %lf systems/s (%.3le system-steps/s)\n", S / time, (double)S * ITERS / time);
+}
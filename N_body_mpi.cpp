@@ -10,11 +10,20 @@
 #include "vector.h"
 #include "body.h"
 #include "util.h"
+#include "exchange.h"
+#ifdef BINARY_OUTPUT
+#include "mpi_io.h"
+#endif
 
 #define ITERS 1000
 #define DELTA_T 100000.0
 #define FRAMES 200
 
+// Position encoding on the wire, see exchange.h
+#ifndef EXCHANGE
+#define EXCHANGE Encoding::DOUBLE
+#endif
+
 void get_accel_sums(std::vector<Vector> &my_accel_sums, Body* my_bodies, Body* my_bodies_othr, int m, int offset)
 {
     for (int i = 0; i < m; ++i)
@@ -35,7 +44,9 @@ int main(int argc, char* argv[])
     int     N;
    	Body*   bodies = nullptr;
     Body*   bodies_new = nullptr;
+#ifndef BINARY_OUTPUT
     Vector* log = nullptr;
+#endif
 
     // Init
     MPI_Init(&argc, &argv);
@@ -62,7 +73,9 @@ int main(int argc, char* argv[])
     {
         read_input(&N, &bodies, &bodies_new);
 
+#ifndef BINARY_OUTPUT
         log = new Vector[N * FRAMES * 2];
+#endif
 
         if (N % procs != 0) {
             printf("Number of objects has to be divisible by the number of tasks\n");
@@ -73,9 +86,11 @@ int main(int argc, char* argv[])
 
     int m = N / procs;
     Body* my_bodies = new Body[m];
-    Body* my_bodies_recv = new Body[m];
     Body* my_bodies_new = new Body[m];
+    Body* others = new Body[N];
+#ifndef BINARY_OUTPUT
     Vector* my_log = new Vector[m * FRAMES * 2];
+#endif
 
     MPI_Scatter(bodies, m, type_body, 
 				my_bodies, m, type_body, 
@@ -85,6 +100,21 @@ int main(int argc, char* argv[])
     for (int i = 0; i < m; ++i)
         my_bodies_new[i].m = my_bodies[i].m;
 
+    // Masses and initial positions of all bodies are sent once, after that only
+    // encoded positions travel around the ring
+    MPI_Allgather(my_bodies, m, type_body, others, m, type_body, MPI_COMM_WORLD);
+
+    PositionExchange exchange;
+    exchange.init(EXCHANGE, N, others);
+    std::vector<unsigned char> send_buffer((size_t)m * exchange.body_bytes());
+    std::vector<unsigned char> recv_buffer((size_t)m * exchange.body_bytes());
+
+#ifdef BINARY_OUTPUT
+    // Every rank writes its own frames, no log is gathered on the root
+    TrajectoryWriter writer;
+    writer.open("data/output.bin", N, FRAMES, myid * m, m, my_bodies, MPI_COMM_WORLD);
+#endif
+
     auto time_start = std::chrono::steady_clock::now();
 
     int frame = 0;
@@ -92,6 +122,8 @@ int main(int argc, char* argv[])
     {
         std::vector<Vector> my_accel_sums(m);
 
+        exchange.encode(my_bodies, myid * m, m, send_buffer.data());
+
         for (int offset = 0; offset < procs; ++offset)
         {   
             //compute local accel
@@ -102,13 +134,16 @@ int main(int argc, char* argv[])
             //compute accel between procs arrays
             else
             {
-                MPI_Sendrecv(my_bodies, m, type_body, (myid + offset) % procs, offset,
-					 my_bodies_recv, m, type_body, (myid - offset + procs) % procs, offset,
+                int source = (myid - offset + procs) % procs;
+                MPI_Sendrecv(send_buffer.data(), send_buffer.size(), MPI_BYTE, (myid + offset) % procs, offset,
+					 recv_buffer.data(), recv_buffer.size(), MPI_BYTE, source, offset,
 					 MPI_COMM_WORLD, MPI_STATUSES_IGNORE);
 
-                get_accel_sums(my_accel_sums, my_bodies, my_bodies_recv, m, offset);
+                exchange.decode(recv_buffer.data(), source * m, m, others + source * m);
+                get_accel_sums(my_accel_sums, my_bodies, others + source * m, m, offset);
             }
         }
+        exchange.count((long long)(procs - 1) * send_buffer.size());
 
         for (int i = 0; i < m; ++i)
         {
@@ -117,10 +152,14 @@ int main(int argc, char* argv[])
         }
 
         if (iter % (ITERS / FRAMES) == 0) {
+#ifdef BINARY_OUTPUT
+            writer.write_frame(frame, my_bodies_new);
+#else
             for (int i = 0; i < m; ++i) {
                 my_log[(i * FRAMES + frame) * 2 + 0] = Vector(my_bodies_new[i].pos);
                 my_log[(i * FRAMES + frame) * 2 + 1] = Vector(my_bodies_new[i].vel);
             }
+#endif
             ++frame;
         }
 
@@ -135,20 +174,28 @@ int main(int argc, char* argv[])
 			   bodies, m, type_body, 
 			   0, MPI_COMM_WORLD);
 
+#ifdef BINARY_OUTPUT
+    writer.close();
+#else
     MPI_Gather(my_log, m * FRAMES * 2, type_vector,
                log, m * FRAMES * 2, type_vector,
                0, MPI_COMM_WORLD);
+#endif
 
     auto time_end = std::chrono::steady_clock::now();
     double time = std::chrono::duration<double>(time_end - time_start).count();
 
     if (myid == 0)
     {
+#ifndef BINARY_OUTPUT
         write_output(N, FRAMES, log, bodies);
+#endif
 
         printf("Required time: %lfs\n", time);
     }
 
+    exchange.report(MPI_COMM_WORLD);
+
     MPI_Type_free(&type_vector);
     MPI_Type_free(&type_body);
 
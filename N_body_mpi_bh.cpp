@@ -11,6 +11,10 @@
 #include "vector.h"
 #include "body.h"
 #include "util.h"
+#include "exchange.h"
+#ifdef BINARY_OUTPUT
+#include "mpi_io.h"
+#endif
 
 #define ITERS 1000
 #define DELTA_T 100000.0
@@ -18,13 +22,20 @@
 
 #define THETA 1.0
 
+// Position encoding on the wire, see exchange.h
+#ifndef EXCHANGE
+#define EXCHANGE Encoding::DOUBLE
+#endif
+
 int main(int argc, char* argv[])
 {
     int     myid, procs;
     int     N;
    	Body*   bodies = nullptr;
     Body*   bodies_new = nullptr;
+#ifndef BINARY_OUTPUT
     Vector* log = nullptr;
+#endif
 
     // Init
     MPI_Init(&argc, &argv);
@@ -51,7 +62,9 @@ int main(int argc, char* argv[])
     {
         read_input(&N, &bodies, &bodies_new);
 
+#ifndef BINARY_OUTPUT
         log = new Vector[N * FRAMES * 2];
+#endif
 
         if (N % procs != 0) {
             printf("Number of objects has to be divisible by the number of tasks\n");
@@ -72,12 +85,30 @@ int main(int argc, char* argv[])
     for (int i = 0; i < N; ++i)
         bodies_new[i].m = bodies[i].m;
 
+    // Masses were sent with the initial bodies, every step only exchanges
+    // encoded positions. Rank 0 gathers full records of the frames it logs.
+    PositionExchange exchange;
+    exchange.init(EXCHANGE, N, bodies);
+    std::vector<unsigned char> buffer((size_t)N * exchange.body_bytes());
+    size_t block_bytes = (size_t)m * exchange.body_bytes();
+#ifndef BINARY_OUTPUT
+    Body* frame_bodies = (myid == 0) ? new Body[N] : nullptr;
+#endif
+
+#ifdef BINARY_OUTPUT
+    // Every rank writes the frames of [myid * m, (myid + 1) * m), no log is kept on the root
+    TrajectoryWriter writer;
+    writer.open("data/output.bin", N, FRAMES, myid * m, m, bodies + myid * m, MPI_COMM_WORLD);
+#endif
+
     auto time_start = std::chrono::steady_clock::now();
     double build_time = 0.0;
     double compute_time = 0.0;
     double dealloc_time = 0.0;
     double comm_time = 0.0;
 
+    std::vector<TreeNode> nodes;
+
     int frame = 0;
     for (int iter = 0; iter < ITERS; ++iter)
     {
@@ -99,11 +130,14 @@ int main(int argc, char* argv[])
             root->insert(&(bodies[i]));
         root->compute_mass_distribution();
 
+        nodes.clear();
+        root->flatten(nodes, THETA);
+
         auto compute_start = std::chrono::steady_clock::now();
         build_time += std::chrono::duration<double>(compute_start - build_start).count();
 
         for (int i = myid * m; i < (myid + 1) * m; ++i) {
-            Vector accel_sum = root->get_acceleration(&(bodies[i]), THETA);
+            Vector accel_sum = tree_acceleration(nodes.data(), nodes.size(), bodies[i].pos);
 
             bodies_new[i].pos = bodies[i].pos + bodies[i].vel * DELTA_T + accel_sum * (0.5 * DELTA_T * DELTA_T);
             bodies_new[i].vel = bodies[i].vel + accel_sum * DELTA_T;
@@ -117,19 +151,32 @@ int main(int argc, char* argv[])
         auto comm_start = std::chrono::steady_clock::now();
         dealloc_time += std::chrono::duration<double>(comm_start - dealloc_start).count();
 
-        MPI_Allgather(MPI_IN_PLACE, m, type_body, bodies_new, m, type_body, MPI_COMM_WORLD);
+        exchange.encode(bodies_new + myid * m, myid * m, m, buffer.data() + myid * block_bytes);
+        MPI_Allgather(MPI_IN_PLACE, block_bytes, MPI_BYTE, buffer.data(), block_bytes, MPI_BYTE, MPI_COMM_WORLD);
+        for (int r = 0; r < procs; ++r)
+            if (r != myid)
+                exchange.decode(buffer.data() + r * block_bytes, r * m, m, bodies_new + r * m);
+        exchange.count((long long)(procs - 1) * block_bytes);
 
         comm_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - comm_start).count();
 
-        if (myid == 0) {
-            if (iter % (ITERS / FRAMES) == 0) {
+#ifdef BINARY_OUTPUT
+        if (iter % (ITERS / FRAMES) == 0) {
+            writer.write_frame(frame, bodies_new + myid * m);
+            ++frame;
+        }
+#else
+        if (iter % (ITERS / FRAMES) == 0) {
+            MPI_Gather(bodies_new + myid * m, m, type_body, frame_bodies, m, type_body, 0, MPI_COMM_WORLD);
+            if (myid == 0) {
                 for (int i = 0; i < N; ++i) {
-                    log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies_new[i].pos);
-                    log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies_new[i].vel);
+                    log[(i * FRAMES + frame) * 2 + 0] = Vector(frame_bodies[i].pos);
+                    log[(i * FRAMES + frame) * 2 + 1] = Vector(frame_bodies[i].vel);
                 }
-                ++frame;
             }
+            ++frame;
         }
+#endif
 
         Body* tmp = bodies_new;
         bodies_new = bodies;
@@ -138,12 +185,18 @@ int main(int argc, char* argv[])
         MPI_Barrier(MPI_COMM_WORLD);
     }
 
+#ifdef BINARY_OUTPUT
+    writer.close();
+#endif
+
     auto time_end = std::chrono::steady_clock::now();
     double time = std::chrono::duration<double>(time_end - time_start).count();
 
     if (myid == 0)
     {
+#ifndef BINARY_OUTPUT
         write_output(N, FRAMES, log, bodies);
+#endif
 
         printf("Required time: %lfs\n", time);
         printf("---------------\n");
@@ -153,6 +206,8 @@ int main(int argc, char* argv[])
         printf("Comm time:    %lfs (%.1lf\%)\n", comm_time, 100.0 * comm_time / time);
     }
 
+    exchange.report(MPI_COMM_WORLD);
+
     MPI_Type_free(&type_vector);
     MPI_Type_free(&type_body);
 
@@ -0,0 +1,500 @@
+// Barnes-Hut with one body array and one tree per node. Ranks of a node share
+// them through MPI shared-memory windows: the top SPLIT_LEVELS levels of the
+// octree split space into cells, every node-local rank sorts its share of the
+// bodies into cells and then builds the subtrees of a contiguous range of
+// cells holding about as many bodies as the other ranks' ranges. The flattened
+// subtrees are placed into the shared tree behind the top nodes. Bodies are
+// exchanged between nodes by the node leaders only.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "/usr/include/openmpi-x86_64/mpi.h"
+#include <math.h>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+
+#include "octree.h"
+#include "vector.h"
+#include "body.h"
+#include "util.h"
+#ifdef BINARY_OUTPUT
+#include "mpi_io.h"
+#endif
+
+#define ITERS 1000
+#define DELTA_T 100000.0
+#define FRAMES 200
+
+#define THETA 1.0
+#define SPLIT_LEVELS 3
+#define CELLS (1 << (3 * SPLIT_LEVELS))
+
+// Per cell: number of bodies, number of tree nodes, mass, center of mass
+struct CellInfo
+{
+    int bodies;
+    int nodes;
+    double m;
+    double pos[3];
+};
+
+// Allocated by the node leader and mapped by every rank of the node
+void* shared_alloc(MPI_Aint size, MPI_Comm node_comm, MPI_Win* win)
+{
+    int node_rank;
+    MPI_Comm_rank(node_comm, &node_rank);
+
+    void* ptr;
+    MPI_Win_allocate_shared(node_rank == 0 ? size : 0, 1, MPI_INFO_NULL, node_comm, &ptr, win);
+
+    MPI_Aint query_size;
+    int disp_unit;
+    MPI_Win_shared_query(*win, 0, &query_size, &disp_unit, &ptr);
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, *win);
+    return ptr;
+}
+
+void shared_free(MPI_Win* win)
+{
+    MPI_Win_unlock_all(*win);
+    MPI_Win_free(win);
+}
+
+// Makes writes to the shared windows visible to all ranks of the node
+void node_sync(std::vector<MPI_Win*> &wins, MPI_Comm node_comm)
+{
+    for (MPI_Win* win : wins)
+        MPI_Win_sync(*win);
+    MPI_Barrier(node_comm);
+    for (MPI_Win* win : wins)
+        MPI_Win_sync(*win);
+}
+
+// Same subdivision as Octant::_insert_into_children
+void child_box(int idx, Vector &range_min, Vector &range_max)
+{
+    Vector range_center = (range_min + range_max) * 0.5;
+    Vector child_min = Vector(
+        (idx & 1) ? range_center.x : range_min.x,
+        (idx & 2) ? range_center.y : range_min.y,
+        (idx & 4) ? range_center.z : range_min.z
+    );
+    Vector child_max = Vector(
+        (idx & 1) ? range_max.x : range_center.x,
+        (idx & 2) ? range_max.y : range_center.y,
+        (idx & 4) ? range_max.z : range_center.z
+    );
+    range_min = child_min;
+    range_max = child_max;
+}
+
+int body_cell(const Vector &pos, Vector range_min, Vector range_max)
+{
+    int cell = 0;
+    for (int level = 0; level < SPLIT_LEVELS; ++level)
+    {
+        Vector range_center = (range_min + range_max) * 0.5;
+        int idx = 0;
+        if (pos.x > range_center.x) idx |= 1;
+        if (pos.y > range_center.y) idx |= 2;
+        if (pos.z > range_center.z) idx |= 4;
+        child_box(idx, range_min, range_max);
+        cell = cell * 8 + idx;
+    }
+    return cell;
+}
+
+// Lays out the levels above the cells in depth-first order starting at node idx
+// and returns the index after the subtree. Records where every cell's subtree
+// goes, computes mass and center of mass like Octant::compute_mass_distribution
+// and writes the top nodes if tree is given.
+int layout_top(int level, int cell0, Vector range_min, Vector range_max, int idx,
+               const CellInfo* cells, int* cell_offset, TreeNode* tree, double &m, Vector &pos)
+{
+    int span = 1;
+    for (int l = level; l < SPLIT_LEVELS; ++l)
+        span *= 8;
+
+    int bodies = 0;
+    int last = cell0;
+    for (int c = cell0; c < cell0 + span; ++c)
+    {
+        bodies += cells[c].bodies;
+        if (cells[c].bodies > 0)
+            last = c;
+    }
+
+    m = 0.0;
+    pos = Vector(0.0, 0.0, 0.0);
+    if (bodies == 0)
+        return idx;
+
+    // A single body or a cell is a subtree built by one of the ranks
+    if (bodies == 1 || level == SPLIT_LEVELS)
+    {
+        cell_offset[last] = idx;
+        m = cells[last].m;
+        pos = Vector(cells[last].pos[0], cells[last].pos[1], cells[last].pos[2]);
+        return idx + cells[last].nodes;
+    }
+
+    int next = idx + 1;
+    for (int k = 0; k < 8; ++k)
+    {
+        Vector child_min = range_min, child_max = range_max;
+        child_box(k, child_min, child_max);
+
+        double child_m;
+        Vector child_pos;
+        next = layout_top(level + 1, cell0 + k * span / 8, child_min, child_max, next,
+                          cells, cell_offset, tree, child_m, child_pos);
+        if (child_m > 0.0)
+        {
+            m += child_m;
+            pos += child_pos * child_m;
+        }
+    }
+    pos *= 1.0 / m;
+
+    if (tree != nullptr)
+    {
+        double width = std::max(std::max(range_max.x - range_min.x, range_max.y - range_min.y), range_max.z - range_min.z);
+        tree[idx].pos = pos;
+        tree[idx].m = m;
+        tree[idx].open2 = (width / THETA) * (width / THETA);
+        tree[idx].next = next;
+    }
+    return next;
+}
+
+int main(int argc, char* argv[])
+{
+    int     myid, procs;
+    int     N;
+    Body*   input = nullptr;
+#ifndef BINARY_OUTPUT
+    Vector* log = nullptr;
+#endif
+
+    // Init
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &myid);
+    MPI_Comm_size(MPI_COMM_WORLD, &procs);
+
+    MPI_Datatype	vector_input_type[1] = {MPI_DOUBLE};
+	int				vector_blocks[1] = {3};
+	MPI_Aint		vector_displacement[1] = {0};
+
+	MPI_Datatype	type_vector;
+	MPI_Type_create_struct(1, vector_blocks, vector_displacement, vector_input_type, &type_vector);
+	MPI_Type_commit(&type_vector);
+
+    MPI_Datatype	body_input_type[2] = {MPI_DOUBLE, type_vector};
+	int				body_blocks[2] = {1, 2};
+	MPI_Aint		body_displacement[2] = {0, sizeof(double)};
+
+    MPI_Datatype	type_body;
+	MPI_Type_create_struct(2, body_blocks, body_displacement, body_input_type, &type_body);
+	MPI_Type_commit(&type_body);
+
+    // Node-local communicator, and one between the node leaders
+    MPI_Comm node_comm, leader_comm;
+    int node_rank, node_size;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, myid, MPI_INFO_NULL, &node_comm);
+    MPI_Comm_rank(node_comm, &node_rank);
+    MPI_Comm_size(node_comm, &node_size);
+    MPI_Comm_split(MPI_COMM_WORLD, node_rank == 0 ? 0 : MPI_UNDEFINED, myid, &leader_comm);
+
+    if (myid == 0)
+    {
+        read_input(&N, &input);
+
+#ifndef BINARY_OUTPUT
+        log = new Vector[N * FRAMES * 2];
+#endif
+    }
+
+    MPI_Bcast(&N, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    // Ranks are numbered node by node, every rank updates a contiguous block
+    // of bodies and every node a contiguous range of them
+    int node_first = 0, nodes = 1;
+    if (node_rank == 0)
+    {
+        MPI_Comm_size(leader_comm, &nodes);
+        MPI_Exscan(&node_size, &node_first, 1, MPI_INT, MPI_SUM, leader_comm);
+        int leader_id;
+        MPI_Comm_rank(leader_comm, &leader_id);
+        if (leader_id == 0)
+            node_first = 0;
+    }
+    MPI_Bcast(&node_first, 1, MPI_INT, 0, node_comm);
+    MPI_Bcast(&nodes, 1, MPI_INT, 0, node_comm);
+
+    int id = node_first + node_rank;
+    int my_lo = (long long)N * id / procs;
+    int my_hi = (long long)N * (id + 1) / procs;
+
+    std::vector<int> node_counts, node_displs;
+    if (node_rank == 0)
+    {
+        int node_lo = (long long)N * node_first / procs;
+        int node_hi = (long long)N * (node_first + node_size) / procs;
+        int node_count = node_hi - node_lo;
+        node_counts.resize(nodes);
+        node_displs.resize(nodes);
+        MPI_Allgather(&node_count, 1, MPI_INT, node_counts.data(), 1, MPI_INT, leader_comm);
+        MPI_Allgather(&node_lo, 1, MPI_INT, node_displs.data(), 1, MPI_INT, leader_comm);
+    }
+
+    // Shared windows: bodies (current and new), cell summaries, the bodies
+    // sorted by cell together with every rank's count per cell, and the tree
+    MPI_Win win_bodies, win_cells, win_bins, win_tree;
+    Body* shared_bodies = (Body*)shared_alloc(2 * (MPI_Aint)N * sizeof(Body), node_comm, &win_bodies);
+    CellInfo* cells = (CellInfo*)shared_alloc(CELLS * sizeof(CellInfo), node_comm, &win_cells);
+    int* bin_counts = (int*)shared_alloc(((MPI_Aint)node_size * CELLS + N) * sizeof(int), node_comm, &win_bins);
+    int* bin_order = bin_counts + node_size * CELLS;
+    int tree_capacity = 4 * N + CELLS;
+    TreeNode* tree = (TreeNode*)shared_alloc((MPI_Aint)tree_capacity * sizeof(TreeNode), node_comm, &win_tree);
+    std::vector<MPI_Win*> wins = {&win_bodies, &win_cells, &win_bins, &win_tree};
+
+    Body* bodies = shared_bodies;
+    Body* bodies_new = shared_bodies + N;
+
+    if (myid == 0)
+    {
+        for (int i = 0; i < N; ++i)
+            bodies[i] = input[i];
+        delete[] input;
+    }
+    if (node_rank == 0)
+    {
+        MPI_Bcast(bodies, N, type_body, 0, leader_comm);
+        // Instead of copying mass each iteration
+        for (int i = 0; i < N; ++i)
+            bodies_new[i].m = bodies[i].m;
+    }
+    node_sync(wins, node_comm);
+
+#ifdef BINARY_OUTPUT
+    TrajectoryWriter writer;
+    writer.open("data/output.bin", N, FRAMES, my_lo, my_hi - my_lo, bodies + my_lo, MPI_COMM_WORLD);
+#endif
+
+    auto time_start = std::chrono::steady_clock::now();
+    double build_time = 0.0;
+    double compute_time = 0.0;
+    double dealloc_time = 0.0;
+    double comm_time = 0.0;
+
+    // The node's bodies are split evenly for sorting them into cells
+    int slice_lo = (long long)N * node_rank / node_size;
+    int slice_hi = (long long)N * (node_rank + 1) / node_size;
+    std::vector<int> slice_cell(slice_hi - slice_lo);
+    std::vector<int> cell_start(CELLS), cell_fill(CELLS);
+
+    std::vector<int> cell_offset(CELLS);
+    std::vector<Octant*> my_cells(CELLS, nullptr);
+    std::vector<std::vector<TreeNode>> my_nodes(CELLS);
+
+    int frame = 0;
+    for (int iter = 0; iter < ITERS; ++iter)
+    {
+        auto build_start = std::chrono::steady_clock::now();
+
+        // Bounding box of all bodies split over the node, maxima negated so
+        // one MPI_MIN covers both
+        double local[6] = { INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY };
+        for (int i = slice_lo; i < slice_hi; ++i) {
+            local[0] = std::min(local[0], bodies[i].pos.x); local[3] = std::min(local[3], -bodies[i].pos.x);
+            local[1] = std::min(local[1], bodies[i].pos.y); local[4] = std::min(local[4], -bodies[i].pos.y);
+            local[2] = std::min(local[2], bodies[i].pos.z); local[5] = std::min(local[5], -bodies[i].pos.z);
+        }
+        double global[6];
+        MPI_Allreduce(local, global, 6, MPI_DOUBLE, MPI_MIN, node_comm);
+        Vector pos_min = Vector(global[0], global[1], global[2]);
+        Vector pos_max = Vector(-global[3], -global[4], -global[5]);
+
+        // Cells of the bodies in this rank's slice
+        int* my_counts = bin_counts + node_rank * CELLS;
+        std::fill(my_counts, my_counts + CELLS, 0);
+        for (int i = slice_lo; i < slice_hi; ++i)
+        {
+            int c = body_cell(bodies[i].pos, pos_min, pos_max);
+            slice_cell[i - slice_lo] = c;
+            ++my_counts[c];
+        }
+        node_sync(wins, node_comm);
+
+        // Counting sort by cell. Slices are placed in rank order, so the bodies
+        // of a cell stay in index order. Every rank computes the same ranges
+        // of cells, cell c goes to the rank whose share of N its middle body
+        // falls into.
+        int cell_lo = CELLS, cell_hi = CELLS;
+        for (int c = 0, sum = 0; c < CELLS; ++c)
+        {
+            int count = 0;
+            cell_fill[c] = sum;
+            for (int r = 0; r < node_size; ++r)
+            {
+                if (r == node_rank)
+                    cell_fill[c] = sum + count;
+                count += bin_counts[r * CELLS + c];
+            }
+            cell_start[c] = sum;
+
+            int owner = std::min(node_size - 1, (int)(((long long)sum + count / 2) * node_size / N));
+            if (owner == node_rank)
+            {
+                if (cell_lo == CELLS)
+                    cell_lo = c;
+                cell_hi = c + 1;
+            }
+            sum += count;
+        }
+        for (int i = slice_lo; i < slice_hi; ++i)
+            bin_order[cell_fill[slice_cell[i - slice_lo]]++] = i;
+        node_sync(wins, node_comm);
+
+        // Subtrees of the cells owned by this rank
+        for (int c = cell_lo; c < cell_hi; ++c)
+        {
+            Vector cell_min = pos_min, cell_max = pos_max;
+            for (int level = SPLIT_LEVELS - 1; level >= 0; --level)
+                child_box((c >> (3 * level)) & 7, cell_min, cell_max);
+            my_cells[c] = new Octant(cell_min, cell_max);
+
+            int end = c + 1 < CELLS ? cell_start[c + 1] : N;
+            for (int k = cell_start[c]; k < end; ++k)
+                my_cells[c]->insert(&(bodies[bin_order[k]]));
+        }
+        for (int c = cell_lo; c < cell_hi; ++c)
+        {
+            my_cells[c]->compute_mass_distribution();
+            my_nodes[c].clear();
+            my_cells[c]->flatten(my_nodes[c], THETA);
+
+            cells[c].bodies = my_cells[c]->count;
+            cells[c].nodes = my_nodes[c].size();
+            cells[c].m = my_cells[c]->m_sum;
+            cells[c].pos[0] = my_cells[c]->pos_avg.x;
+            cells[c].pos[1] = my_cells[c]->pos_avg.y;
+            cells[c].pos[2] = my_cells[c]->pos_avg.z;
+        }
+        node_sync(wins, node_comm);
+
+        // Every rank computes the same layout, the tree grows if it has to
+        double m_total;
+        Vector pos_total;
+        int tree_size = layout_top(0, 0, pos_min, pos_max, 0, cells, cell_offset.data(), nullptr, m_total, pos_total);
+        if (tree_size > tree_capacity)
+        {
+            shared_free(&win_tree);
+            tree_capacity = tree_size + tree_size / 2;
+            tree = (TreeNode*)shared_alloc((MPI_Aint)tree_capacity * sizeof(TreeNode), node_comm, &win_tree);
+        }
+
+        if (node_rank == 0)
+            layout_top(0, 0, pos_min, pos_max, 0, cells, cell_offset.data(), tree, m_total, pos_total);
+        for (int c = cell_lo; c < cell_hi; ++c)
+        {
+            int offset = cell_offset[c];
+            for (int k = 0; k < (int)my_nodes[c].size(); ++k)
+            {
+                tree[offset + k] = my_nodes[c][k];
+                tree[offset + k].next += offset;
+            }
+        }
+        node_sync(wins, node_comm);
+
+        auto compute_start = std::chrono::steady_clock::now();
+        build_time += std::chrono::duration<double>(compute_start - build_start).count();
+
+        for (int i = my_lo; i < my_hi; ++i) {
+            Vector accel_sum = tree_acceleration(tree, tree_size, bodies[i].pos);
+
+            bodies_new[i].pos = bodies[i].pos + bodies[i].vel * DELTA_T + accel_sum * (0.5 * DELTA_T * DELTA_T);
+            bodies_new[i].vel = bodies[i].vel + accel_sum * DELTA_T;
+        }
+
+        auto dealloc_start = std::chrono::steady_clock::now();
+        compute_time += std::chrono::duration<double>(dealloc_start - compute_start).count();
+
+        for (int c = cell_lo; c < cell_hi; ++c)
+        {
+            delete my_cells[c];
+            my_cells[c] = nullptr;
+        }
+
+        auto comm_start = std::chrono::steady_clock::now();
+        dealloc_time += std::chrono::duration<double>(comm_start - dealloc_start).count();
+
+        // Inter-node exchange, once per node
+        node_sync(wins, node_comm);
+        if (node_rank == 0 && nodes > 1)
+            MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, bodies_new, node_counts.data(), node_displs.data(), type_body, leader_comm);
+        node_sync(wins, node_comm);
+
+        comm_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - comm_start).count();
+
+#ifdef BINARY_OUTPUT
+        if (iter % (ITERS / FRAMES) == 0) {
+            writer.write_frame(frame, bodies_new + my_lo);
+            ++frame;
+        }
+#else
+        if (myid == 0) {
+            if (iter % (ITERS / FRAMES) == 0) {
+                for (int i = 0; i < N; ++i) {
+                    log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies_new[i].pos);
+                    log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies_new[i].vel);
+                }
+                ++frame;
+            }
+        }
+#endif
+
+        Body* tmp = bodies_new;
+        bodies_new = bodies;
+        bodies = tmp;
+    }
+
+#ifdef BINARY_OUTPUT
+    writer.close();
+#endif
+
+    auto time_end = std::chrono::steady_clock::now();
+    double time = std::chrono::duration<double>(time_end - time_start).count();
+
+    if (myid == 0)
+    {
+#ifndef BINARY_OUTPUT
+        write_output(N, FRAMES, log, bodies);
+#endif
+
+        printf("Required time: %lfs\n", time);
+        printf("Nodes: %d, ranks on the first node: %d\n", nodes, node_size);
+        printf("---------------\n");
+        printf("Build time:   %lfs (%.1lf%%)\n", build_time, 100.0 * build_time / time);
+        printf("Compute time: %lfs (%.1lf%%)\n", compute_time, 100.0 * compute_time / time);
+        printf("Dealloc time: %lfs (%.1lf%%)\n", dealloc_time, 100.0 * dealloc_time / time);
+        printf("Comm time:    %lfs (%.1lf%%)\n", comm_time, 100.0 * comm_time / time);
+    }
+
+    shared_free(&win_tree);
+    shared_free(&win_bins);
+    shared_free(&win_cells);
+    shared_free(&win_bodies);
+    if (leader_comm != MPI_COMM_NULL)
+        MPI_Comm_free(&leader_comm);
+    MPI_Comm_free(&node_comm);
+
+    MPI_Type_free(&type_vector);
+    MPI_Type_free(&type_body);
+
+    MPI_Finalize();
+
+    return 0;
+}
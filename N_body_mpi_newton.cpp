@@ -11,6 +11,10 @@
 #include "vector.h"
 #include "body.h"
 #include "util.h"
+#include "exchange.h"
+#ifdef BINARY_OUTPUT
+#include "mpi_io.h"
+#endif
 
 #define ITERS 1000
 #define DELTA_T 100000.0
@@ -18,6 +22,11 @@
 
 #define THETA 1.0
 
+// Position encoding on the wire, see exchange.h
+#ifndef EXCHANGE
+#define EXCHANGE Encoding::DOUBLE
+#endif
+
 
 int main(int argc, char* argv[])
 {
@@ -27,7 +36,9 @@ int main(int argc, char* argv[])
     Body*   bodies_new = nullptr;
     Vector* forces = nullptr;
     Vector* forces_sum = nullptr;
+#ifndef BINARY_OUTPUT
     Vector* log = nullptr;
+#endif
 
     // Init
     MPI_Init(&argc, &argv);
@@ -54,7 +65,9 @@ int main(int argc, char* argv[])
     {
         read_input(&N, &bodies, &bodies_new);
 
+#ifndef BINARY_OUTPUT
         log = new Vector[N * FRAMES * 2];
+#endif
 
         if (N % procs != 0) {
             printf("N * (N - 1) / 2 has to be divisible by the number of tasks\n");
@@ -77,6 +90,34 @@ int main(int argc, char* argv[])
     for (int i = 0; i < N; ++i)
         bodies_new[i].m = bodies[i].m;
 
+    // Every rank integrates its share of the bodies: pair forces are summed
+    // straight into the owners' shares (reduce-scatter) and only encoded
+    // positions are gathered back. Masses were sent with the initial bodies.
+    int own_lo = (long long)N * myid / procs;
+    int own_hi = (long long)N * (myid + 1) / procs;
+    std::vector<int> force_counts(procs), position_counts(procs), position_displs(procs), body_counts(procs), body_displs(procs);
+    PositionExchange exchange;
+    exchange.init(EXCHANGE, N, bodies);
+    for (int r = 0; r < procs; ++r) {
+        int lo = (long long)N * r / procs;
+        int hi = (long long)N * (r + 1) / procs;
+        force_counts[r] = 3 * (hi - lo);
+        position_counts[r] = (hi - lo) * exchange.body_bytes();
+        position_displs[r] = lo * exchange.body_bytes();
+        body_counts[r] = hi - lo;
+        body_displs[r] = lo;
+    }
+    std::vector<unsigned char> buffer((size_t)N * exchange.body_bytes());
+#ifndef BINARY_OUTPUT
+    Body* frame_bodies = (myid == 0) ? new Body[N] : nullptr;
+#endif
+
+#ifdef BINARY_OUTPUT
+    // Every rank writes the frames of its share of the bodies, no log is kept on the root
+    TrajectoryWriter writer;
+    writer.open("data/output.bin", N, FRAMES, own_lo, own_hi - own_lo, bodies + own_lo, MPI_COMM_WORLD);
+#endif
+
     auto time_start = std::chrono::steady_clock::now();
     double compute_time = 0.0;
     double comm_time = 0.0;
@@ -107,25 +148,46 @@ int main(int argc, char* argv[])
         auto comm_start = std::chrono::steady_clock::now();
         compute_time += std::chrono::duration<double>(comm_start - compute_start).count();
 
-        MPI_Allreduce(forces, forces_sum, N * 3, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+        MPI_Reduce_scatter(forces, forces_sum + own_lo, force_counts.data(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
 
-        comm_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - comm_start).count();
+        auto update_start = std::chrono::steady_clock::now();
+        comm_time += std::chrono::duration<double>(update_start - comm_start).count();
 
-        for (int i = 0; i < N; ++i) {
+        for (int i = own_lo; i < own_hi; ++i) {
             Vector accel_sum = forces_sum[i] / bodies[i].m;
             bodies_new[i].pos = bodies[i].pos + bodies[i].vel * DELTA_T + accel_sum * (0.5 * DELTA_T * DELTA_T);
             bodies_new[i].vel = bodies[i].vel + accel_sum * DELTA_T;
         }
 
-        if (myid == 0) {
-            if (iter % (ITERS / FRAMES) == 0) {
+        auto gather_start = std::chrono::steady_clock::now();
+        compute_time += std::chrono::duration<double>(gather_start - update_start).count();
+
+        exchange.encode(bodies_new + own_lo, own_lo, own_hi - own_lo, buffer.data() + position_displs[myid]);
+        MPI_Allgatherv(MPI_IN_PLACE, 0, MPI_DATATYPE_NULL, buffer.data(), position_counts.data(), position_displs.data(), MPI_BYTE, MPI_COMM_WORLD);
+        for (int r = 0; r < procs; ++r)
+            if (r != myid)
+                exchange.decode(buffer.data() + position_displs[r], body_displs[r], body_counts[r], bodies_new + body_displs[r]);
+        exchange.count(sizeof(double) * (N * 3LL - force_counts[myid]) + (long long)(procs - 1) * position_counts[myid]);
+
+        comm_time += std::chrono::duration<double>(std::chrono::steady_clock::now() - gather_start).count();
+
+#ifdef BINARY_OUTPUT
+        if (iter % (ITERS / FRAMES) == 0) {
+            writer.write_frame(frame, bodies_new + own_lo);
+            ++frame;
+        }
+#else
+        if (iter % (ITERS / FRAMES) == 0) {
+            MPI_Gatherv(bodies_new + own_lo, own_hi - own_lo, type_body, frame_bodies, body_counts.data(), body_displs.data(), type_body, 0, MPI_COMM_WORLD);
+            if (myid == 0) {
                 for (int i = 0; i < N; ++i) {
-                    log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies_new[i].pos);
-                    log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies_new[i].vel);
+                    log[(i * FRAMES + frame) * 2 + 0] = Vector(frame_bodies[i].pos);
+                    log[(i * FRAMES + frame) * 2 + 1] = Vector(frame_bodies[i].vel);
                 }
-                ++frame;
             }
+            ++frame;
         }
+#endif
 
         Body* tmp = bodies_new;
         bodies_new = bodies;
@@ -134,12 +196,18 @@ int main(int argc, char* argv[])
         MPI_Barrier(MPI_COMM_WORLD);
     }
 
+#ifdef BINARY_OUTPUT
+    writer.close();
+#endif
+
     auto time_end = std::chrono::steady_clock::now();
     double time = std::chrono::duration<double>(time_end - time_start).count();
 
     if (myid == 0)
     {
+#ifndef BINARY_OUTPUT
         write_output(N, FRAMES, log, bodies);
+#endif
 
         printf("Required time: %lfs\n", time);
         printf("---------------\n");
@@ -147,6 +215,8 @@ int main(int argc, char* argv[])
         printf("Comm time:    %lfs (%.1lf\%)\n", comm_time, 100.0 * comm_time / time);
     }
 
+    exchange.report(MPI_COMM_WORLD);
+
     MPI_Type_free(&type_vector);
     MPI_Type_free(&type_body);
 
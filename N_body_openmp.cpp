@@ -2,75 +2,73 @@
 #include <stdio.h>
 #include <math.h>
 #include <string>
-#include <omp.h>
 #include <chrono>
 #include "vector.h"
 #include "body.h"
+#include "simulation.h"
+#include "numa.h"
 #include "util.h"
 
 #define ITERS 10000
 #define DELTA_T 100000.0
 #define FRAMES 2000
 
+// Placement of the bodies and the log (first argument):
+//   serial       allocated and filled by the master thread
+//   first-touch  first touched in parallel by the threads that update them (default)
+//   replicate    first-touch, and every NUMA node reads sources from its own copy
 int main(int argc, char* argv[])
 {
-    int N;
-    Body *bodies, *bodies_new;
-    read_input(&N, &bodies, &bodies_new);
-
-    Vector* log = new Vector[N * FRAMES * 2];
-    
-    auto time_start = std::chrono::steady_clock::now();
-
-    #pragma omp parallel
-    {
-        int p = omp_get_thread_num();
-        int procs = omp_get_num_threads();
-
-        int frame = 0;
-        for (int iter = 0; iter < ITERS; ++iter)
-        {
+    std::string placement = (argc > 1) ? argv[1] : "first-touch";
+    if (placement != "serial" && placement != "first-touch" && placement != "replicate") {
+        printf("Unknown placement: %s\n", placement.c_str());
+        return 1;
+    }
+    print_topology(detect_topology());
+    printf("Placement: %s\n", placement.c_str());
 
-            for (int i = p; i < N; i += procs)
-            {
-                Vector accel_sum = Vector();
-                for (int j = 0; j < N; ++j)
-                {   
-                    if (i != j)
-                    {
-                        accel_sum += bodies[i].acceleration(bodies[j]);
-                    }
-                }
+    int N;
+    Body *bodies;
+    read_input(&N, &bodies);
 
-                bodies_new[i].pos = bodies[i].pos + bodies[i].vel * DELTA_T + accel_sum * (0.5 * DELTA_T * DELTA_T);
-                bodies_new[i].vel = bodies[i].vel + accel_sum * DELTA_T;
-            }
+    Vector* log;
+    if (placement == "serial") {
+        log = new Vector[N * FRAMES * 2];
+    } else {
+        Body *input = bodies;
+        bodies = alloc_first_touch<Body>(N);
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < N; ++i)
+            bodies[i] = input[i];
+        delete[] input;
 
-            if (iter % (ITERS / FRAMES) == 0) {
-                for (int i = p; i < N; i += procs) {
-                    log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies_new[i].pos);
-                    log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies_new[i].vel);
-                }
-                ++frame;
-            }
+        log = alloc_first_touch<Vector>((long long)N * FRAMES * 2, FRAMES * 2);
+    }
 
-            #pragma omp barrier
+    Simulation sim(N, bodies);
+    sim.set_solver(Solver::DIRECT_OPENMP);
+    sim.set_numa_replicate(placement == "replicate");
+    sim.set_delta_t(DELTA_T);
+    sim.set_frame_callback(ITERS / FRAMES, [&](Simulation &sim, int frame) {
+        #pragma omp parallel for schedule(static)
+        for (int i = 0; i < N; ++i) {
+            log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies[i].pos);
+            log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies[i].vel);
+        }
+    });
 
-            #pragma omp master
-            {
-                Body* tmp = bodies_new;
-                bodies_new = bodies;
-                bodies = tmp;
-            }
+    auto time_start = std::chrono::steady_clock::now();
 
-            #pragma omp barrier
-        }
-    }
+    sim.step(ITERS);
 
     auto time_end = std::chrono::steady_clock::now();
     double time = std::chrono::duration<double>(time_end - time_start).count();
 
+#ifdef BINARY_OUTPUT
+    write_output_binary(N, FRAMES, log, bodies);
+#else
     write_output(N, FRAMES, log, bodies);
+#endif
 
     printf("Required time: %lfs\n", time);
 }
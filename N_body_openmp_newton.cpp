@@ -0,0 +1,51 @@
+// OpenMP implementation using Newton's third law: every pair is evaluated once,
+// see accels_direct_newton in solvers.h
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <chrono>
+#include "vector.h"
+#include "body.h"
+#include "simulation.h"
+#include "util.h"
+
+#define ITERS 10000
+#define DELTA_T 100000.0
+#define FRAMES 2000
+
+int main(int argc, char* argv[])
+{
+    int N;
+    Body *bodies;
+    read_input(&N, &bodies);
+
+    Vector* log = new Vector[N * FRAMES * 2];
+
+    Simulation sim(N, bodies);
+    sim.set_solver(Solver::DIRECT_NEWTON);
+    sim.set_delta_t(DELTA_T);
+    sim.set_frame_callback(ITERS / FRAMES, [&](Simulation &sim, int frame) {
+        #pragma omp parallel for
+        for (int i = 0; i < N; ++i) {
+            log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies[i].pos);
+            log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies[i].vel);
+        }
+    });
+
+    auto time_start = std::chrono::steady_clock::now();
+
+    sim.step(ITERS);
+
+    auto time_end = std::chrono::steady_clock::now();
+    double time = std::chrono::duration<double>(time_end - time_start).count();
+
+#ifdef BINARY_OUTPUT
+    write_output_binary(N, FRAMES, log, bodies);
+#else
+    write_output(N, FRAMES, log, bodies);
+#endif
+
+    printf("Required time: %lfs\n", time);
+}
@@ -0,0 +1,16 @@
+#!/bin/sh
+#SBATCH --ntasks=1
+#SBATCH --cpus-per-task=64
+#SBATCH --constraint=AMD
+#SBATCH --time=00:15:00
+#SBATCH --output=N_body_numa_benchmark.log
+#SBATCH --reservation=fri
+
+# Compares data placements of the OpenMP version on both sockets
+export OMP_PLACES=cores
+export OMP_PROC_BIND=spread
+export OMP_NUM_THREADS=64
+
+for placement in serial first-touch replicate; do
+    ./N_body_openmp $placement
+done
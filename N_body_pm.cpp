@@ -0,0 +1,53 @@
+// Particle-mesh (P3M with the short-range correction) solver, see pm.h
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string>
+#include <chrono>
+#include "vector.h"
+#include "body.h"
+#include "simulation.h"
+#include "util.h"
+
+#define ITERS 10000
+#define DELTA_T 100000.0
+#define FRAMES 2000
+
+#define GRID 64
+#define SHORT_RANGE true
+
+int main(int argc, char* argv[])
+{
+    int N;
+    Body *bodies;
+    read_input(&N, &bodies);
+
+    Vector* log = new Vector[N * FRAMES * 2];
+
+    Simulation sim(N, bodies);
+    sim.set_solver(Solver::PARTICLE_MESH);
+    sim.set_delta_t(DELTA_T);
+    sim.set_mesh(GRID, MassAssignment::CIC, SHORT_RANGE);
+    sim.set_frame_callback(ITERS / FRAMES, [&](Simulation &sim, int frame) {
+        for (int i = 0; i < N; ++i) {
+            log[(i * FRAMES + frame) * 2 + 0] = Vector(bodies[i].pos);
+            log[(i * FRAMES + frame) * 2 + 1] = Vector(bodies[i].vel);
+        }
+    });
+
+    auto time_start = std::chrono::steady_clock::now();
+
+    sim.step(ITERS);
+
+    auto time_end = std::chrono::steady_clock::now();
+    double time = std::chrono::duration<double>(time_end - time_start).count();
+
+#ifdef BINARY_OUTPUT
+    write_output_binary(N, FRAMES, log, bodies);
+#else
+    write_output(N, FRAMES, log, bodies);
+#endif
+
+    printf("Required time: %lfs\n", time);
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+// Many small independent systems advanced together. Every quantity is stored
+// as [body * S + system], so the pairwise loops run over systems in the
+// innermost loop (one SIMD lane per system) and threads take blocks of systems.
+// Systems never interact, so every block runs all of its steps without any
+// synchronization with the other blocks.
+
+#include <math.h>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include "vector.h"
+#include "body.h"
+
+#define ENSEMBLE_BLOCK 64
+
+class Ensemble {
+public:
+	// Called with the block of systems [s0, s1) after every interval-th step
+	typedef std::function<void(Ensemble &, int, int, int)> FrameCallback;
+
+	int S, N;
+	std::vector<double> m, x, y, z, vx, vy, vz;
+
+private:
+	std::vector<double> ax, ay, az;
+
+public:
+	// bodies[s * N + i] is body i of system s
+	Ensemble(int S, int N, const Body *bodies)
+		: S(S), N(N), m(S * N), x(S * N), y(S * N), z(S * N), vx(S * N), vy(S * N), vz(S * N),
+		  ax(S * N), ay(S * N), az(S * N) {
+		for (int s = 0; s < S; ++s) {
+			for (int i = 0; i < N; ++i) {
+				const Body &b = bodies[s * N + i];
+				int idx = i * S + s;
+				m[idx] = b.m;
+				x[idx] = b.pos.x; y[idx] = b.pos.y; z[idx] = b.pos.z;
+				vx[idx] = b.vel.x; vy[idx] = b.vel.y; vz[idx] = b.vel.z;
+			}
+		}
+	}
+
+	Body get_body(int s, int i) const {
+		int idx = i * S + s;
+		return Body(m[idx], Vector(x[idx], y[idx], z[idx]), Vector(vx[idx], vy[idx], vz[idx]));
+	}
+
+	void run(int iters, double delta_t, int frame_interval, FrameCallback callback) {
+		int blocks = (S + ENSEMBLE_BLOCK - 1) / ENSEMBLE_BLOCK;
+
+		#pragma omp parallel for schedule(dynamic)
+		for (int block = 0; block < blocks; ++block) {
+			int s0 = block * ENSEMBLE_BLOCK;
+			int s1 = std::min(S, s0 + ENSEMBLE_BLOCK);
+
+			int frame = 0;
+			for (int iter = 0; iter < iters; ++iter) {
+				_step(s0, s1, delta_t);
+
+				if (callback && frame_interval > 0 && iter % frame_interval == 0)
+					callback(*this, s0, s1, frame++);
+			}
+		}
+	}
+
+private:
+	void _step(int s0, int s1, double dt) {
+		double *x = this->x.data(), *y = this->y.data(), *z = this->z.data();
+		double *vx = this->vx.data(), *vy = this->vy.data(), *vz = this->vz.data();
+		double *ax = this->ax.data(), *ay = this->ay.data(), *az = this->az.data();
+		const double *m = this->m.data();
+
+		for (int i = 0; i < N; ++i) {
+			#pragma omp simd
+			for (int s = s0; s < s1; ++s) {
+				ax[i * S + s] = 0.0;
+				ay[i * S + s] = 0.0;
+				az[i * S + s] = 0.0;
+			}
+		}
+
+		// Every pair once with one division, -KAPPA / d^3 * m instead of
+		// Body::acceleration's m / d^3 * -KAPPA, so results can differ from the
+		// serial solver in the last bits
+		for (int i = 0; i < N; ++i) {
+			for (int j = i + 1; j < N; ++j) {
+				int a = i * S, b = j * S;
+				#pragma omp simd
+				for (int s = s0; s < s1; ++s) {
+					double dx = x[a + s] - x[b + s];
+					double dy = y[a + s] - y[b + s];
+					double dz = z[a + s] - z[b + s];
+					double dist = sqrt(dx * dx + dy * dy + dz * dz) + EPS;
+					double f = -KAPPA / (dist * dist * dist);
+
+					ax[a + s] += dx * (f * m[b + s]);
+					ay[a + s] += dy * (f * m[b + s]);
+					az[a + s] += dz * (f * m[b + s]);
+					ax[b + s] -= dx * (f * m[a + s]);
+					ay[b + s] -= dy * (f * m[a + s]);
+					az[b + s] -= dz * (f * m[a + s]);
+				}
+			}
+		}
+
+		double half_dt2 = 0.5 * dt * dt;
+		for (int i = 0; i < N; ++i) {
+			#pragma omp simd
+			for (int s = i * S + s0; s < i * S + s1; ++s) {
+				x[s] = x[s] + vx[s] * dt + ax[s] * half_dt2;
+				y[s] = y[s] + vy[s] * dt + ay[s] * half_dt2;
+				z[s] = z[s] + vz[s] * dt + az[s] * half_dt2;
+				vx[s] = vx[s] + ax[s] * dt;
+				vy[s] = vy[s] + ay[s] * dt;
+				vz[s] = vz[s] + az[s] * dt;
+			}
+		}
+	}
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+// Compressed position exchange for the MPI solvers. Masses do not change and
+// are sent once at startup together with the initial positions, after that
+// only positions go over the wire, encoded as
+//
+//     DOUBLE  3 doubles, exact (24 bytes per body)
+//     FLOAT   3 floats (12 bytes), relative error ~6e-8 of the coordinate
+//     DELTA   3 floats (12 bytes) holding the change since the previous step
+//
+// For DELTA, senders and receivers keep the same reconstructed positions and
+// the sender encodes the difference between the exact position and that
+// reconstruction, so rounding errors are fed back and never accumulate; the
+// error stays at float precision of the (small) step instead of the coordinate.
+// The encoder measures the error of everything it sends.
+
+#include "/usr/include/openmpi-x86_64/mpi.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#include "vector.h"
+#include "body.h"
+
+enum class Encoding {
+	DOUBLE,
+	FLOAT,
+	DELTA
+};
+
+inline const char *encoding_name(Encoding encoding) {
+	switch (encoding) {
+	case Encoding::DOUBLE: return "double";
+	case Encoding::FLOAT: return "float";
+	case Encoding::DELTA: return "delta";
+	}
+	return "";
+}
+
+class PositionExchange {
+private:
+	Encoding encoding = Encoding::DOUBLE;
+	std::vector<Vector> reference;  // DELTA: reconstructed positions of all bodies
+
+	double max_error = 0.0;      // Largest absolute position error sent
+	double max_relative = 0.0;   // Largest error relative to the position's length
+	long long bytes = 0;         // Bytes sent by this rank
+	long long steps = 0;
+
+public:
+	// bodies are the exact initial positions of all N bodies, known to every rank
+	void init(Encoding encoding, int N, const Body *bodies) {
+		this->encoding = encoding;
+		reference.resize(encoding == Encoding::DELTA ? N : 0);
+		for (int i = 0; i < (int)reference.size(); ++i)
+			reference[i] = bodies[i].pos;
+	}
+
+	int body_bytes() const {
+		return encoding == Encoding::DOUBLE ? 3 * sizeof(double) : 3 * sizeof(float);
+	}
+
+	// Encodes the positions of block, which holds bodies [lo, lo + count)
+	void encode(const Body *block, int lo, int count, unsigned char *buffer) {
+		for (int b = 0; b < count; ++b) {
+			const Vector &pos = block[b].pos;
+			Vector decoded;
+			if (encoding == Encoding::DOUBLE) {
+				double v[3] = { pos.x, pos.y, pos.z };
+				memcpy(buffer + b * sizeof(v), v, sizeof(v));
+				decoded = pos;
+			} else if (encoding == Encoding::FLOAT) {
+				float v[3] = { (float)pos.x, (float)pos.y, (float)pos.z };
+				memcpy(buffer + b * sizeof(v), v, sizeof(v));
+				decoded = Vector(v[0], v[1], v[2]);
+			} else {
+				Vector &ref = reference[lo + b];
+				float v[3] = { (float)(pos.x - ref.x), (float)(pos.y - ref.y), (float)(pos.z - ref.z) };
+				memcpy(buffer + b * sizeof(v), v, sizeof(v));
+				ref += Vector(v[0], v[1], v[2]);
+				decoded = ref;
+			}
+
+			Vector diff = decoded - pos;
+			double error = diff.length();
+			max_error = std::max(max_error, error);
+			if (error > 0.0)
+				max_relative = std::max(max_relative, error / Vector(pos).length());
+		}
+	}
+
+	// Writes the positions of block, which holds bodies [lo, lo + count).
+	// Masses and velocities are left alone.
+	void decode(const unsigned char *buffer, int lo, int count, Body *block) {
+		for (int b = 0; b < count; ++b) {
+			Vector &pos = block[b].pos;
+			if (encoding == Encoding::DOUBLE) {
+				double v[3];
+				memcpy(v, buffer + b * sizeof(v), sizeof(v));
+				pos = Vector(v[0], v[1], v[2]);
+			} else if (encoding == Encoding::FLOAT) {
+				float v[3];
+				memcpy(v, buffer + b * sizeof(v), sizeof(v));
+				pos = Vector(v[0], v[1], v[2]);
+			} else {
+				float v[3];
+				memcpy(v, buffer + b * sizeof(v), sizeof(v));
+				Vector &ref = reference[lo + b];
+				ref += Vector(v[0], v[1], v[2]);
+				pos = ref;
+			}
+		}
+	}
+
+	// Called once per step with the bytes this rank sent
+	void count(long long sent) {
+		bytes += sent;
+		++steps;
+	}
+
+	// Collective, printed by rank 0
+	void report(MPI_Comm comm) {
+		int myid;
+		MPI_Comm_rank(comm, &myid);
+
+		double local[2] = { max_error, max_relative }, global[2];
+		long long total;
+		MPI_Reduce(local, global, 2, MPI_DOUBLE, MPI_MAX, 0, comm);
+		MPI_Reduce(&bytes, &total, 1, MPI_LONG_LONG, MPI_SUM, 0, comm);
+
+		if (myid == 0) {
+			printf("Exchange:     %s, %d bytes per body, %.3lf MB per step (all ranks)\n",
+				encoding_name(encoding), body_bytes(), steps > 0 ? total / (1e6 * steps) : 0.0);
+			printf("Max error:    %le m (%le relative)\n", global[0], global[1]);
+		}
+	}
+};
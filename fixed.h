@@ -0,0 +1,160 @@
+#pragma once
+
+// Direct summation for small systems whose body count N and precision T are
+// template parameters. The state is copied into stack arrays for a run of
+// steps, and the pair loops have compile-time bounds, so they are fully
+// unrolled and the i != j test of the generic loop disappears. Every pair
+// computes its distance once; accelerations are then summed in the same order
+// and with the same expressions as accels_direct, so double precision results
+// are bit-identical to Solver::DIRECT.
+//
+// make_fixed_runner picks the instantiation for a runtime N and returns
+// nullptr outside [FIXED_MIN_N, FIXED_MAX_N], where callers fall back to the
+// generic path.
+
+#include <math.h>
+#include <memory>
+#include <utility>
+#include "vector.h"
+#include "body.h"
+
+#define FIXED_MIN_N 2
+#define FIXED_MAX_N 10
+
+template <int N, typename T>
+struct FixedState {
+	T m[N], x[N], y[N], z[N];
+	T vx[N], vy[N], vz[N];
+	T ax[N], ay[N], az[N];
+};
+
+template <int N, typename T>
+inline void fixed_accels(FixedState<N, T> &s) {
+	T dist3[N][N];
+	#pragma GCC unroll 16
+	for (int i = 0; i < N; ++i) {
+		#pragma GCC unroll 16
+		for (int j = i + 1; j < N; ++j) {
+			T dx = s.x[i] - s.x[j], dy = s.y[i] - s.y[j], dz = s.z[i] - s.z[j];
+			T dist = sqrt(dx * dx + dy * dy + dz * dz) + (T)EPS;
+			dist3[i][j] = dist * dist * dist;
+		}
+	}
+
+	#pragma GCC unroll 16
+	for (int i = 0; i < N; ++i) {
+		T ax = 0.0, ay = 0.0, az = 0.0;
+		#pragma GCC unroll 16
+		for (int j = 0; j < N; ++j) {
+			if (j == i)  // Resolved at compile time once unrolled
+				continue;
+			T dx = s.x[i] - s.x[j], dy = s.y[i] - s.y[j], dz = s.z[i] - s.z[j];
+			T f = s.m[j] / (j < i ? dist3[j][i] : dist3[i][j]) * -(T)KAPPA;
+			ax += dx * f;
+			ay += dy * f;
+			az += dz * f;
+		}
+		s.ax[i] = ax;
+		s.ay[i] = ay;
+		s.az[i] = az;
+	}
+}
+
+// x += v dt + a dt^2 / 2, v += a dt
+template <int N, typename T>
+inline void fixed_step_taylor(FixedState<N, T> &s, T dt) {
+	fixed_accels(s);
+	T h = 0.5 * dt * dt;
+	#pragma GCC unroll 16
+	for (int i = 0; i < N; ++i) {
+		s.x[i] = s.x[i] + s.vx[i] * dt + s.ax[i] * h;
+		s.y[i] = s.y[i] + s.vy[i] * dt + s.ay[i] * h;
+		s.z[i] = s.z[i] + s.vz[i] * dt + s.az[i] * h;
+		s.vx[i] = s.vx[i] + s.ax[i] * dt;
+		s.vy[i] = s.vy[i] + s.ay[i] * dt;
+		s.vz[i] = s.vz[i] + s.az[i] * dt;
+	}
+}
+
+// Kick-drift-kick, accelerations have to be current
+template <int N, typename T>
+inline void fixed_step_leapfrog(FixedState<N, T> &s, T dt) {
+	T h = 0.5 * dt;
+	#pragma GCC unroll 16
+	for (int i = 0; i < N; ++i) {
+		s.vx[i] += s.ax[i] * h;
+		s.vy[i] += s.ay[i] * h;
+		s.vz[i] += s.az[i] * h;
+		s.x[i] += s.vx[i] * dt;
+		s.y[i] += s.vy[i] * dt;
+		s.z[i] += s.vz[i] * dt;
+	}
+	fixed_accels(s);
+	#pragma GCC unroll 16
+	for (int i = 0; i < N; ++i) {
+		s.vx[i] += s.ax[i] * h;
+		s.vy[i] += s.ay[i] * h;
+		s.vz[i] += s.az[i] * h;
+	}
+}
+
+// Type-erased access to one instantiation, called once per run of steps
+class FixedRunner {
+public:
+	virtual ~FixedRunner() {}
+	virtual void load(const Body *bodies) = 0;
+	virtual void store(Body *bodies, Vector *accels) const = 0;
+	virtual void run(int steps, double dt, bool leapfrog) = 0;
+};
+
+template <int N, typename T>
+class FixedRunnerImpl : public FixedRunner {
+private:
+	FixedState<N, T> state;
+
+public:
+	void load(const Body *bodies) override {
+		for (int i = 0; i < N; ++i) {
+			state.m[i] = bodies[i].m;
+			state.x[i] = bodies[i].pos.x; state.y[i] = bodies[i].pos.y; state.z[i] = bodies[i].pos.z;
+			state.vx[i] = bodies[i].vel.x; state.vy[i] = bodies[i].vel.y; state.vz[i] = bodies[i].vel.z;
+		}
+	}
+
+	void store(Body *bodies, Vector *accels) const override {
+		for (int i = 0; i < N; ++i) {
+			bodies[i].pos = Vector(state.x[i], state.y[i], state.z[i]);
+			bodies[i].vel = Vector(state.vx[i], state.vy[i], state.vz[i]);
+			accels[i] = Vector(state.ax[i], state.ay[i], state.az[i]);
+		}
+	}
+
+	// Leapfrog starts from accelerations of the loaded positions, which are the
+	// same ones a previous run ended with
+	void run(int steps, double dt, bool leapfrog) override {
+		FixedState<N, T> s = state;
+		if (leapfrog) {
+			fixed_accels(s);
+			for (int k = 0; k < steps; ++k)
+				fixed_step_leapfrog(s, (T)dt);
+		} else {
+			for (int k = 0; k < steps; ++k)
+				fixed_step_taylor(s, (T)dt);
+		}
+		state = s;
+	}
+};
+
+template <typename T, int... Ns>
+std::unique_ptr<FixedRunner> make_fixed_runner(int N, std::integer_sequence<int, Ns...>) {
+	std::unique_ptr<FixedRunner> runner;
+	((N == FIXED_MIN_N + Ns ? (runner.reset(new FixedRunnerImpl<FIXED_MIN_N + Ns, T>()), 0) : 0), ...);
+	return runner;
+}
+
+inline std::unique_ptr<FixedRunner> make_fixed_runner(int N, bool single_precision = false) {
+	typedef std::make_integer_sequence<int, FIXED_MAX_N - FIXED_MIN_N + 1> sizes;
+	if (single_precision)
+		return make_fixed_runner<float>(N, sizes());
+	return make_fixed_runner<double>(N, sizes());
+}
@@ -0,0 +1,259 @@
+// Parallel generator of initial conditions
+//
+// Usage: generate_data <plummer|hernquist|disk|cube|collision> <N> [seed] [-t]
+// Writes data/input.bin, or data/input.txt with -t. Bodies are generated in
+// fixed-size chunks, each with its own RNG stream seeded from (seed, chunk),
+// so the output does not depend on the number of threads.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include "vector.h"
+#include "body.h"
+#include "util.h"
+
+#define TOTAL_MASS 1e25
+#define SCALE_RADIUS 1e10
+#define CHUNK 4096
+
+typedef std::mt19937_64 Rng;
+
+double uniform(Rng &rng, double lo, double hi)
+{
+    return std::uniform_real_distribution<double>(lo, hi)(rng);
+}
+
+// normal_distribution needs sigma > 0, a zero dispersion gives zero
+double gaussian(Rng &rng, double sigma)
+{
+    if (!(sigma > 0.0))
+        return 0.0;
+    return std::normal_distribution<double>(0.0, sigma)(rng);
+}
+
+Vector random_direction(Rng &rng)
+{
+    double cos_theta = uniform(rng, -1.0, 1.0);
+    double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+    double phi = uniform(rng, 0.0, 2.0 * M_PI);
+    return Vector(sin_theta * cos(phi), cos_theta, sin_theta * sin(phi));
+}
+
+// Aarseth, Henon & Wielen (1974), truncated at 99.9% of the mass
+Body plummer(Rng &rng, double M, double a, int n)
+{
+    double r = a / sqrt(pow(uniform(rng, 1e-6, 0.999), -2.0 / 3.0) - 1.0);
+
+    // Von Neumann rejection for q = v / v_escape
+    double q, g;
+    do {
+        q = uniform(rng, 0.0, 1.0);
+        g = uniform(rng, 0.0, 0.1);
+    } while (g > q * q * pow(1.0 - q * q, 3.5));
+    double v = q * sqrt(2.0 * KAPPA * M) * pow(r * r + a * a, -0.25);
+
+    return Body(M / n, random_direction(rng) * r, random_direction(rng) * v);
+}
+
+// Isotropic Jeans velocity dispersion, Hernquist (1990) eq. 10
+double hernquist_sigma(double M, double a, double r)
+{
+    double x = r / a;
+    double s2 = KAPPA * M / (12.0 * a) * (12.0 * x * pow(1.0 + x, 3) * log((1.0 + x) / x)
+        - x / (1.0 + x) * (25.0 + 52.0 * x + 42.0 * x * x + 12.0 * x * x * x));
+    return s2 > 0.0 ? sqrt(s2) : 0.0;
+}
+
+// Truncated at 95% of the mass, Gaussian velocities with the local dispersion
+Body hernquist(Rng &rng, double M, double a, int n)
+{
+    double s = sqrt(uniform(rng, 1e-6, 0.95));
+    double r = a * s / (1.0 - s);
+    double sigma = hernquist_sigma(M, a, r);
+    Vector vel = Vector(gaussian(rng, sigma), gaussian(rng, sigma), gaussian(rng, sigma));
+
+    return Body(M / n, random_direction(rng) * r, vel);
+}
+
+// Central body with half of the mass and an exponential disk in the xz plane,
+// on near-circular orbits around the enclosed mass
+Body disk(Rng &rng, double M, double a, int n, int i)
+{
+    double m_center = 0.5 * M;
+    double m_disk = M - m_center;
+    if (i == 0)
+        return Body(m_center, Vector(), Vector());
+
+    // Surface density exp(-R / a) gives R ~ Gamma(2, a)
+    double R;
+    do {
+        R = -a * log(uniform(rng, 1e-12, 1.0) * uniform(rng, 1e-12, 1.0));
+    } while (R < 0.2 * a || R > 10.0 * a);
+    double phi = uniform(rng, 0.0, 2.0 * M_PI);
+    double x = R / a;
+    double m_enc = m_center + m_disk * (1.0 - (1.0 + x) * exp(-x));
+    double v_c = sqrt(KAPPA * m_enc / R);
+
+    Vector pos = Vector(R * sin(phi), gaussian(rng, 0.05 * a), R * cos(phi));
+    Vector vel = Vector(cos(phi), 0.0, -sin(phi)) * v_c;
+    vel += Vector(sin(phi), 0.0, cos(phi)) * gaussian(rng, 0.05 * v_c);
+    vel.y += gaussian(rng, 0.05 * v_c);
+
+    return Body(m_disk / (n - 1), pos, vel);
+}
+
+// Cold uniform cube
+Body cube(Rng &rng, double M, double a, int n)
+{
+    Vector pos = Vector(uniform(rng, -a, a), uniform(rng, -a, a), uniform(rng, -a, a));
+    return Body(M / n, pos, Vector());
+}
+
+// Two disks approaching each other with an impact parameter, the second one tilted
+Body collision(Rng &rng, double M, double a, int n, int i)
+{
+    int half = n / 2;
+    bool second = i >= half;
+    Body b = second ? disk(rng, 0.5 * M, a, n - half, i - half) : disk(rng, 0.5 * M, a, half, i);
+
+    if (second) {
+        double tilt = M_PI / 3.0;
+        b.pos = Vector(b.pos.x, b.pos.y * cos(tilt) - b.pos.z * sin(tilt), b.pos.y * sin(tilt) + b.pos.z * cos(tilt));
+        b.vel = Vector(b.vel.x, b.vel.y * cos(tilt) - b.vel.z * sin(tilt), b.vel.y * sin(tilt) + b.vel.z * cos(tilt));
+    }
+
+    double d = 8.0 * a;
+    double v = 0.5 * sqrt(KAPPA * M / d);
+    double side = second ? 1.0 : -1.0;
+    b.pos += Vector(side * 0.5 * d, 0.0, side * a);
+    b.vel += Vector(-side * v, 0.0, 0.0);
+    return b;
+}
+
+bool write_binary(int N, Body *bodies)
+{
+    FILE *out_file = fopen("data/input.bin", "wb");
+    if (out_file == nullptr) {
+        printf("Cannot write data/input.bin\n");
+        return false;
+    }
+    int32_t info[3] = { INPUT_VERSION, N, 0 };
+    fwrite(INPUT_MAGIC, 1, 4, out_file);
+    fwrite(info, sizeof(info), 1, out_file);
+    fwrite(bodies, sizeof(Body), N, out_file);
+    fclose(out_file);
+    return true;
+}
+
+bool write_text(int N, Body *bodies)
+{
+    int chunks = (N + CHUNK - 1) / CHUNK;
+    std::vector<std::string> text(chunks);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < chunks; ++c) {
+        char line[256];
+        for (int i = c * CHUNK; i < std::min(N, (c + 1) * CHUNK); ++i) {
+            const Body &b = bodies[i];
+            int len = snprintf(line, sizeof(line), "%.17g %.17g %.17g %.17g %.17g %.17g %.17g\n",
+                b.m, b.pos.x, b.pos.y, b.pos.z, b.vel.x, b.vel.y, b.vel.z);
+            text[c].append(line, len);
+        }
+    }
+
+    FILE *out_file = fopen("data/input.txt", "w");
+    if (out_file == nullptr) {
+        printf("Cannot write data/input.txt\n");
+        return false;
+    }
+    fprintf(out_file, "%d\n", N);
+    for (int c = 0; c < chunks; ++c)
+        fwrite(text[c].data(), 1, text[c].size(), out_file);
+    fclose(out_file);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 3) {
+        printf("Usage: %s <plummer|hernquist|disk|cube|collision> <N> [seed] [-t]\n", argv[0]);
+        return 1;
+    }
+    std::string type = argv[1];
+    int N = atoi(argv[2]);
+    unsigned long long seed = 42;
+    bool text = false;
+    for (int a = 3; a < argc; ++a) {
+        if (strcmp(argv[a], "-t") == 0)
+            text = true;
+        else
+            seed = strtoull(argv[a], nullptr, 10);
+    }
+    if (type != "plummer" && type != "hernquist" && type != "disk" && type != "cube" && type != "collision") {
+        printf("Unknown distribution: %s\n", type.c_str());
+        return 1;
+    }
+    if (N < 2) {
+        printf("Number of bodies has to be at least 2\n");
+        return 1;
+    }
+
+    auto time_start = std::chrono::steady_clock::now();
+
+    Body *bodies = new Body[N];
+    int chunks = (N + CHUNK - 1) / CHUNK;
+    std::vector<double> chunk_sums(chunks * 7, 0.0);
+
+    #pragma omp parallel for schedule(dynamic)
+    for (int c = 0; c < chunks; ++c) {
+        std::seed_seq seq = { (unsigned)(seed >> 32), (unsigned)seed, (unsigned)c };
+        Rng rng(seq);
+
+        double *sums = &chunk_sums[c * 7];
+        for (int i = c * CHUNK; i < std::min(N, (c + 1) * CHUNK); ++i) {
+            if (type == "plummer") bodies[i] = plummer(rng, TOTAL_MASS, SCALE_RADIUS, N);
+            else if (type == "hernquist") bodies[i] = hernquist(rng, TOTAL_MASS, SCALE_RADIUS, N);
+            else if (type == "disk") bodies[i] = disk(rng, TOTAL_MASS, SCALE_RADIUS, N, i);
+            else if (type == "cube") bodies[i] = cube(rng, TOTAL_MASS, SCALE_RADIUS, N);
+            else bodies[i] = collision(rng, TOTAL_MASS, SCALE_RADIUS, N, i);
+
+            const Body &b = bodies[i];
+            sums[0] += b.m;
+            sums[1] += b.m * b.pos.x; sums[2] += b.m * b.pos.y; sums[3] += b.m * b.pos.z;
+            sums[4] += b.m * b.vel.x; sums[5] += b.m * b.vel.y; sums[6] += b.m * b.vel.z;
+        }
+    }
+
+    // Move to the center of mass frame, summing chunks in order for reproducibility
+    double total[7] = { 0.0 };
+    for (int c = 0; c < chunks; ++c)
+        for (int k = 0; k < 7; ++k)
+            total[k] += chunk_sums[c * 7 + k];
+    Vector pos_cm = Vector(total[1], total[2], total[3]) / total[0];
+    Vector vel_cm = Vector(total[4], total[5], total[6]) / total[0];
+
+    #pragma omp parallel for
+    for (int i = 0; i < N; ++i) {
+        bodies[i].pos -= pos_cm;
+        bodies[i].vel -= vel_cm;
+    }
+
+    bool written = text ? write_text(N, bodies) : write_binary(N, bodies);
+    delete[] bodies;
+    if (!written)
+        return 1;
+    // A leftover data/input.bin would be read instead of the new text file
+    if (text)
+        remove("data/input.bin");
+
+    auto time_end = std::chrono::steady_clock::now();
+    double time = std::chrono::duration<double>(time_end - time_start).count();
+
+    printf("Required time: %lfs\n", time);
+}
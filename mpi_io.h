@@ -0,0 +1,124 @@
+#pragma once
+
+// Parallel binary trajectory output (format in util.h and the README). Every
+// rank writes the frames of its own bodies straight into the shared file at
+// computed offsets with collective MPI-IO, so nothing is gathered on the root.
+// If MPI-IO cannot open the file, ranks fall back to POSIX writes at the same
+// offsets, which works on a local or node-shared file system.
+
+#include "/usr/include/openmpi-x86_64/mpi.h"
+#include <stdio.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
+#include "vector.h"
+#include "body.h"
+#include "util.h"
+
+class TrajectoryWriter {
+private:
+	MPI_Comm comm;
+	MPI_File file;
+	int fd = -1;
+	bool use_mpi_io = true;
+	int myid;
+
+	int N, FRAMES;
+	int lo, count;
+	std::vector<uint16_t> coords;
+
+public:
+	// Collective. The calling rank owns bodies [lo, lo + count).
+	void open(const char *path, int N, int FRAMES, int lo, int count, const Body *my_bodies, MPI_Comm comm) {
+		this->comm = comm;
+		this->N = N;
+		this->FRAMES = FRAMES;
+		this->lo = lo;
+		this->count = count;
+		coords.resize(3 * (size_t)count);
+		MPI_Comm_rank(comm, &myid);
+
+		long long total = traj_frame_offset(N, FRAMES, FRAMES);
+		int err = MPI_File_open(comm, path, MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &file);
+		int ok = (err == MPI_SUCCESS), all_ok;
+		MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, comm);
+		if (all_ok) {
+			MPI_File_set_size(file, total);
+		} else {
+			if (ok)
+				MPI_File_close(&file);
+			use_mpi_io = false;
+			if (myid == 0) {
+				printf("MPI-IO unavailable, writing %s with POSIX I/O\n", path);
+				fd = ::open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+				if (fd >= 0 && ftruncate(fd, total) != 0)
+					perror("ftruncate");
+			}
+			MPI_Barrier(comm);
+			if (myid != 0)
+				fd = ::open(path, O_WRONLY);
+		}
+
+		// Header without masses from the root, every rank adds its own masses
+		std::vector<float> masses(count);
+		for (int b = 0; b < count; ++b)
+			masses[b] = (float)my_bodies[b].m;
+
+		std::vector<unsigned char> header;
+		if (myid == 0) {
+			std::vector<float> no_masses(N, 0.0f);
+			header.resize(traj_header_size(N, FRAMES));
+			traj_write_header(N, FRAMES, no_masses.data(), header.data());
+		}
+		long long table = traj_align8(16 + 4LL * N);
+		_write_at(0, header.data(), myid == 0 ? 16 : 0);
+		_write_at(table, header.data() + (myid == 0 ? table : 0), myid == 0 ? 8LL * FRAMES : 0);
+		_write_at(16 + 4LL * lo, masses.data(), 4LL * count);
+	}
+
+	// Collective. my_bodies are the calling rank's bodies.
+	void write_frame(int frame, const Body *my_bodies) {
+		// Global bounding box, maxima negated so one MPI_MIN covers both
+		double local[6] = { INFINITY, INFINITY, INFINITY, INFINITY, INFINITY, INFINITY };
+		for (int b = 0; b < count; ++b) {
+			const Vector &p = my_bodies[b].pos;
+			local[0] = std::min(local[0], p.x); local[3] = std::min(local[3], -p.x);
+			local[1] = std::min(local[1], p.y); local[4] = std::min(local[4], -p.y);
+			local[2] = std::min(local[2], p.z); local[5] = std::min(local[5], -p.z);
+		}
+		double global[6];
+		MPI_Allreduce(local, global, 6, MPI_DOUBLE, MPI_MIN, comm);
+
+		float bbox[6];
+		traj_bbox(Vector(global[0], global[1], global[2]), Vector(-global[3], -global[4], -global[5]), bbox);
+		for (int b = 0; b < count; ++b)
+			traj_encode(my_bodies[b].pos, bbox, &coords[3 * b]);
+
+		long long offset = traj_frame_offset(N, FRAMES, frame);
+		_write_at(offset, bbox, myid == 0 ? sizeof(bbox) : 0);
+		_write_at(offset + 24 + 6LL * lo, coords.data(), 6LL * count);
+	}
+
+	// Collective
+	void close() {
+		if (use_mpi_io) {
+			MPI_File_close(&file);
+		} else {
+			if (fd >= 0)
+				::close(fd);
+			MPI_Barrier(comm);
+		}
+	}
+
+private:
+	void _write_at(long long offset, const void *data, long long size) {
+		if (use_mpi_io) {
+			MPI_File_write_at_all(file, offset, data, (int)size, MPI_BYTE, MPI_STATUS_IGNORE);
+		} else if (size > 0 && fd >= 0) {
+			if (pwrite(fd, data, size, offset) != size)
+				perror("pwrite");
+		}
+	}
+};
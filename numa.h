@@ -0,0 +1,195 @@
+#pragma once
+
+// NUMA placement for the OpenMP solvers. Linux places a page on the node of
+// the thread that first writes it, so arrays are first touched in parallel
+// with the same static schedule the solvers use, and read-only sources can be
+// replicated once per node. The topology is read from sysfs; threads are
+// expected to be pinned (OMP_PROC_BIND, OMP_PLACES).
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include "body.h"
+
+#ifdef __linux__
+#include <sched.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#define PAGE_SIZE 4096
+
+struct NumaTopology {
+	int nodes = 1;
+	std::vector<int> cpu_node;      // Node of every cpu
+	std::vector<int> thread_cpu;    // Cpu of every OpenMP thread
+	std::vector<int> thread_node;   // Node of every OpenMP thread
+	std::vector<int> thread_rank;   // Rank among the threads of the same node
+	std::vector<int> node_threads;  // Number of threads on every node
+};
+
+// Parses cpu lists such as "0-15,32-47"
+inline std::vector<int> parse_cpulist(const std::string &list) {
+	std::vector<int> cpus;
+	std::stringstream ss(list);
+	std::string range;
+	while (std::getline(ss, range, ',')) {
+		int lo, hi;
+		int n = sscanf(range.c_str(), "%d-%d", &lo, &hi);
+		if (n == 1) hi = lo;
+		if (n >= 1)
+			for (int c = lo; c <= hi; ++c)
+				cpus.push_back(c);
+	}
+	return cpus;
+}
+
+inline NumaTopology detect_topology() {
+	NumaTopology topo;
+
+	int node = 0;
+	for (;; ++node) {
+		std::ifstream in_file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+		std::string list;
+		if (!in_file.is_open() || !std::getline(in_file, list))
+			break;
+		for (int cpu : parse_cpulist(list)) {
+			if (cpu >= (int)topo.cpu_node.size())
+				topo.cpu_node.resize(cpu + 1, 0);
+			topo.cpu_node[cpu] = node;
+		}
+	}
+	topo.nodes = node > 0 ? node : 1;
+
+	int threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	topo.thread_cpu.assign(threads, -1);
+	topo.thread_node.assign(threads, 0);
+
+#ifdef _OPENMP
+	#pragma omp parallel
+#endif
+	{
+		int t = 0;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+#endif
+#ifdef __linux__
+		int cpu = sched_getcpu();
+		topo.thread_cpu[t] = cpu;
+		if (cpu >= 0 && cpu < (int)topo.cpu_node.size())
+			topo.thread_node[t] = topo.cpu_node[cpu];
+#endif
+	}
+
+	topo.node_threads.assign(topo.nodes, 0);
+	topo.thread_rank.assign(threads, 0);
+	for (int t = 0; t < threads; ++t)
+		topo.thread_rank[t] = topo.node_threads[topo.thread_node[t]]++;
+
+	return topo;
+}
+
+inline void print_topology(const NumaTopology &topo) {
+	printf("NUMA nodes: %d, threads: %d\n", topo.nodes, (int)topo.thread_node.size());
+	for (int n = 0; n < topo.nodes; ++n) {
+		printf("  Node %d: %d threads (cpus", n, topo.node_threads[n]);
+		for (int t = 0; t < (int)topo.thread_node.size(); ++t)
+			if (topo.thread_node[t] == n)
+				printf(" %d", topo.thread_cpu[t]);
+		printf(")\n");
+	}
+}
+
+// Page-aligned array whose pages are first touched by the threads that own
+// them under schedule(static) over count / chunk rows of chunk elements
+template <typename T>
+T *alloc_first_touch(long long count, long long chunk = 1) {
+	size_t size = ((count * sizeof(T) + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+	T *data = (T *)aligned_alloc(PAGE_SIZE, size > 0 ? size : PAGE_SIZE);
+
+	long long rows = count / chunk;
+#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+#endif
+	for (long long r = 0; r < rows; ++r)
+		for (long long k = r * chunk; k < (r + 1) * chunk; ++k)
+			new (&data[k]) T();
+	for (long long k = rows * chunk; k < count; ++k)
+		new (&data[k]) T();
+
+	return data;
+}
+
+template <typename T>
+void free_first_touch(T *data) {
+	free(data);
+}
+
+// One copy of the source bodies per NUMA node, refreshed every step by the
+// threads of that node so the pages stay local to them
+class NumaReplicas {
+private:
+	NumaTopology topo;
+	std::vector<Body *> copies;
+	int N = 0;
+
+public:
+	void init(int N) {
+		release();
+		this->N = N;
+		topo = detect_topology();
+		size_t size = ((N * sizeof(Body) + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+		copies.assign(topo.nodes, nullptr);
+		for (int n = 0; n < topo.nodes; ++n)
+			copies[n] = (Body *)aligned_alloc(PAGE_SIZE, size > 0 ? size : PAGE_SIZE);
+	}
+
+	void release() {
+		for (Body *copy : copies)
+			free(copy);
+		copies.clear();
+	}
+
+	~NumaReplicas() {
+		release();
+	}
+
+	const NumaTopology &get_topology() const {
+		return topo;
+	}
+
+	// Must be called by every thread of the parallel region, returns the copy
+	// local to the calling thread. The slices follow the threads seen by init(),
+	// a region with a different thread count reads the shared array instead.
+	Body *update(const Body *bodies) {
+		int t = 0, threads = 1;
+#ifdef _OPENMP
+		t = omp_get_thread_num();
+		threads = omp_get_num_threads();
+#endif
+		if (threads != (int)topo.thread_node.size())
+			return (Body *)bodies;
+
+		int node = topo.thread_node[t];
+		int rank = topo.thread_rank[t];
+		int count = topo.node_threads[node];
+
+		long long lo = (long long)N * rank / count;
+		long long hi = (long long)N * (rank + 1) / count;
+		memcpy((void *)(copies[node] + lo), bodies + lo, (hi - lo) * sizeof(Body));
+
+#ifdef _OPENMP
+		#pragma omp barrier
+#endif
+		return copies[node];
+	}
+};
@@ -1,9 +1,81 @@
 #pragma once
 
 #include <algorithm>
+#include <vector>
 #include "vector.h"
 #include "body.h"
 
+// Node of the linearized tree. Nodes are stored in depth-first order, so the
+// first child of a cell directly follows it and next skips its whole subtree.
+struct TreeNode {
+	Vector pos;    // Center of mass (the body itself for leaves)
+	double m;      // Total mass
+	double open2;  // Cells closer than sqrt(open2) = width / theta are opened, negative for leaves
+	int next;      // Index of the first node after the subtree
+};
+
+// Neighbor search data of the node with the same index, kept in a parallel
+// array so walks without a search radius do not load it
+struct TreeNeighbor {
+	double reach2;  // Cells closer than sqrt(reach2) may hold a neighbor and are opened too
+	int body;       // Index of the body for leaves, -1 for cells
+};
+
+// Stackless walk over a tree produced by Octant::flatten
+inline Vector tree_acceleration(const TreeNode *nodes, int count, const Vector &pos) {
+	Vector acc = Vector(0.0, 0.0, 0.0);
+	int i = 0;
+	while (i < count) {
+		const TreeNode &node = nodes[i];
+		Vector diff = pos - node.pos;
+		double dist2 = diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
+
+		if (node.open2 < 0.0) {
+			double dist = sqrt(dist2) + EPS;
+			acc += diff * (node.m / (dist * dist * dist) * -KAPPA);
+			i = node.next;
+		} else if (dist2 > node.open2) {
+			double dist = sqrt(dist2);
+			acc += diff * (node.m / (dist * dist * dist + EPS) * -KAPPA);
+			i = node.next;
+		} else {
+			++i;
+		}
+	}
+	return acc;
+}
+
+// Same walk that also reports every body closer than sqrt(radius2) to pos as
+// found(body, dist2), including the body at pos itself. The tree has to be
+// flattened with neighbors and a radius of at least sqrt(radius2). Cells that
+// may hold a neighbor are opened, so neighbors always interact as single bodies.
+template <typename Found>
+inline Vector tree_acceleration_neighbors(const TreeNode *nodes, const TreeNeighbor *neighbors, int count,
+                                          const Vector &pos, double radius2, Found found) {
+	Vector acc = Vector(0.0, 0.0, 0.0);
+	int i = 0;
+	while (i < count) {
+		const TreeNode &node = nodes[i];
+		Vector diff = pos - node.pos;
+		double dist2 = diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
+
+		if (node.open2 < 0.0) {
+			double dist = sqrt(dist2) + EPS;
+			acc += diff * (node.m / (dist * dist * dist) * -KAPPA);
+			if (dist2 < radius2)
+				found(neighbors[i].body, dist2);
+			i = node.next;
+		} else if (dist2 > node.open2 && dist2 > neighbors[i].reach2) {
+			double dist = sqrt(dist2);
+			acc += diff * (node.m / (dist * dist * dist + EPS) * -KAPPA);
+			i = node.next;
+		} else {
+			++i;
+		}
+	}
+	return acc;
+}
+
 class Octant {
 public:
 	int count = 0;
@@ -64,31 +136,48 @@ public:
 					pos_avg += children[i]->pos_avg * children[i]->m_sum;
 				}
 			}
-			pos_avg *= 1.0 / m_sum;
+			// Cells of massless bodies are centered on their box
+			if (m_sum > 0.0)
+				pos_avg *= 1.0 / m_sum;
+			else
+				pos_avg = range_center;
 		}
 	}
 
-	Vector get_acceleration(Body *b, double theta) {
-		Vector acc;
+	// Appends the subtree to nodes in depth-first order, with the opening
+	// criterion for theta precomputed. With neighbors (the same size as nodes),
+	// the search data for radius is appended too: leaves know their index in
+	// bodies (the array the inserted bodies live in), and cells are opened
+	// wherever one of their bodies may be closer than the radius. No body is
+	// further than sqrt(3) width from the center of mass.
+	void flatten(std::vector<TreeNode> &nodes, double theta, std::vector<TreeNeighbor> *neighbors = nullptr,
+	             const Body *bodies = nullptr, double radius = 0.0) const {
+		if (count == 0)
+			return;
+
+		int idx = nodes.size();
+		nodes.push_back(TreeNode());
+		if (neighbors != nullptr)
+			neighbors->push_back(TreeNeighbor { -1.0, -1 });
 		if (count == 1) {
-			acc = b->acceleration(*(this->body));
-		} else if (count > 1) {
-			Vector diff = (b->pos - pos_avg);
-			double dist = diff.length();
-			double quotient = this->width / dist;
-
-			if (quotient < theta) {
-				acc = diff * (m_sum / (dist * dist * dist + EPS) * -KAPPA);
-			} else {
-				acc = Vector(0.0, 0.0, 0.0);
-				for (int i = 0; i < 8; ++i) {
-					if (children[i] != nullptr) {
-						acc += children[i]->get_acceleration(b, theta);
-					}
+			nodes[idx].pos = body->pos;
+			nodes[idx].m = body->m;
+			nodes[idx].open2 = -1.0;
+			if (neighbors != nullptr)
+				(*neighbors)[idx].body = body - bodies;
+		} else {
+			nodes[idx].pos = pos_avg;
+			nodes[idx].m = m_sum;
+			nodes[idx].open2 = (width / theta) * (width / theta);
+			if (neighbors != nullptr)
+				(*neighbors)[idx].reach2 = (radius + sqrt(3.0) * width) * (radius + sqrt(3.0) * width);
+			for (int i = 0; i < 8; ++i) {
+				if (children[i] != nullptr) {
+					children[i]->flatten(nodes, theta, neighbors, bodies, radius);
 				}
 			}
 		}
-		return acc;
+		nodes[idx].next = nodes.size();
 	}
 
 private:
@@ -0,0 +1,346 @@
+#pragma once
+
+// Particle-mesh gravity. Masses are assigned to a grid (CIC or TSC) and the
+// potential is their convolution with a Green's function, computed with FFTs
+// on a zero-padded grid of twice the size so there are no periodic images.
+// Accelerations are 4-point finite differences of the potential, interpolated
+// back to the bodies with the same assignment.
+//
+// The Green's function only holds the long-range part -G erf(r / 2 r_s) / r of
+// the potential, r_s = PM_SPLIT cells. With the short-range correction (P3M)
+// the remaining erfc part is summed directly over neighbors closer than
+// PM_CUTOFF r_s; without it, forces are smoothed below a few cells.
+
+#include <math.h>
+#include <complex>
+#include <vector>
+#include <algorithm>
+#include "vector.h"
+#include "body.h"
+
+#define PM_MARGIN 4     // Empty cells kept on every side of the bodies
+#define PM_MIN_GRID 16  // Smallest grid, bodies span the G - 2 PM_MARGIN - 1 cells inside the margins
+#define PM_SPLIT 1.25   // Force split scale r_s in cells
+#define PM_CUTOFF 5.0   // Short-range cutoff in r_s
+
+static_assert(PM_MIN_GRID - 2 * PM_MARGIN - 1 > 0, "No room for bodies inside the margins");
+
+typedef std::complex<double> cplx;
+
+enum class MassAssignment {
+	CIC,  // Cloud-in-cell, 2x2x2 cells
+	TSC   // Triangular-shaped cloud, 3x3x3 cells
+};
+
+// In-place radix-2 FFT of n values (a power of two), unnormalized. twiddles
+// holds exp(-2 pi i k / n) for k < n / 2.
+inline void fft(cplx *a, int n, const cplx *twiddles, bool inverse) {
+	for (int i = 1, j = 0; i < n; ++i) {
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1)
+			j ^= bit;
+		j ^= bit;
+		if (i < j)
+			std::swap(a[i], a[j]);
+	}
+	for (int len = 2; len <= n; len <<= 1) {
+		int step = n / len;
+		for (int i = 0; i < n; i += len) {
+			for (int k = 0; k < len / 2; ++k) {
+				cplx w = inverse ? std::conj(twiddles[k * step]) : twiddles[k * step];
+				cplx u = a[i + k];
+				cplx v = a[i + k + len / 2] * w;
+				a[i + k] = u + v;
+				a[i + k + len / 2] = u - v;
+			}
+		}
+	}
+}
+
+class ParticleMesh {
+private:
+	int G = 0;   // Cells per side holding bodies
+	int M = 0;   // Padded cells per side, 2 G
+	MassAssignment assignment = MassAssignment::TSC;
+	bool short_range = true;
+
+	double h = 0.0;  // Cell size, the Green's function only depends on it
+	Vector origin;
+
+	std::vector<cplx> twiddles;
+	std::vector<cplx> green;  // Transformed Green's function
+	std::vector<cplx> rho;    // Masses, then potential
+	std::vector<Vector> field;
+
+	std::vector<int> cell_start, cell_bodies;
+
+public:
+	// grid is rounded up to a power of two, at least PM_MIN_GRID
+	void init(int grid, MassAssignment assignment, bool short_range) {
+		G = PM_MIN_GRID;
+		while (G < grid)
+			G *= 2;
+		M = 2 * G;
+		this->assignment = assignment;
+		this->short_range = short_range;
+		h = 0.0;
+
+		twiddles.resize(M / 2);
+		for (int k = 0; k < M / 2; ++k)
+			twiddles[k] = std::polar(1.0, -2.0 * M_PI * k / M);
+		green.assign((size_t)M * M * M, 0.0);
+		rho.assign((size_t)M * M * M, 0.0);
+		field.assign((size_t)G * G * G, Vector());
+	}
+
+	int get_grid() const { return G; }
+	double get_cell_size() const { return h; }
+
+	void compute(int N, const Body *bodies, Vector *accels, const Vector &pos_min, const Vector &pos_max) {
+		if (G == 0)
+			init(64, assignment, short_range);
+		_place(pos_min, pos_max);
+
+		// Masses into the corner G^3 of the padded grid
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (size_t k = 0; k < rho.size(); ++k)
+			rho[k] = 0.0;
+
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int i = 0; i < N; ++i) {
+			int c[3];
+			double w[3][3];
+			int n = _weights(bodies[i].pos, c, w);
+			for (int a = 0; a < n; ++a)
+				for (int b = 0; b < n; ++b)
+					for (int d = 0; d < n; ++d) {
+						size_t k = ((size_t)(c[0] + a) * M + (c[1] + b)) * M + (c[2] + d);
+						double *target = reinterpret_cast<double *>(&rho[k]);
+#ifdef _OPENMP
+						#pragma omp atomic
+#endif
+						*target += bodies[i].m * w[0][a] * w[1][b] * w[2][d];
+					}
+		}
+
+		// Potential
+		_fft_3d(rho.data(), false, G);
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (size_t k = 0; k < rho.size(); ++k)
+			rho[k] *= green[k];
+		_fft_3d(rho.data(), true, G);
+
+		// Accelerations on the grid, -grad phi with 4-point differences. Bodies
+		// are at least PM_MARGIN cells from the edges, so the outermost cells
+		// are never read.
+		double norm = 1.0 / ((double)M * M * M);
+		double s = -norm / (12.0 * h);
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int x = 2; x < G - 2; ++x) {
+			for (int y = 2; y < G - 2; ++y) {
+				for (int z = 2; z < G - 2; ++z) {
+					Vector &f = field[((size_t)x * G + y) * G + z];
+					f.x = s * (8.0 * (_phi(x + 1, y, z) - _phi(x - 1, y, z)) - (_phi(x + 2, y, z) - _phi(x - 2, y, z)));
+					f.y = s * (8.0 * (_phi(x, y + 1, z) - _phi(x, y - 1, z)) - (_phi(x, y + 2, z) - _phi(x, y - 2, z)));
+					f.z = s * (8.0 * (_phi(x, y, z + 1) - _phi(x, y, z - 1)) - (_phi(x, y, z + 2) - _phi(x, y, z - 2)));
+				}
+			}
+		}
+
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int i = 0; i < N; ++i) {
+			int c[3];
+			double w[3][3];
+			int n = _weights(bodies[i].pos, c, w);
+			Vector accel_sum = Vector();
+			for (int a = 0; a < n; ++a)
+				for (int b = 0; b < n; ++b)
+					for (int d = 0; d < n; ++d)
+						accel_sum += field[((size_t)(c[0] + a) * G + (c[1] + b)) * G + (c[2] + d)] * (w[0][a] * w[1][b] * w[2][d]);
+			accels[i] = accel_sum;
+		}
+
+		if (short_range)
+			_short_range(N, bodies, accels, pos_min, pos_max);
+	}
+
+private:
+	double _phi(int x, int y, int z) const {
+		return rho[((size_t)x * M + y) * M + z].real();
+	}
+
+	// Centers the grid on the bodies. The cell size, and with it the Green's
+	// function, only changes when the bodies no longer fit or take up less
+	// than half of the grid.
+	void _place(const Vector &pos_min, const Vector &pos_max) {
+		double extent = std::max(std::max(pos_max.x - pos_min.x, pos_max.y - pos_min.y), pos_max.z - pos_min.z);
+		double needed = extent / (G - 2 * PM_MARGIN - 1);
+		if (extent <= 0.0) {
+			// Coincident bodies fit any cell size, keep the current one
+			if (h <= 0.0) {
+				h = 1.0;
+				_green();
+			}
+		} else if (h < needed || h > 2.0 * needed) {
+			h = 1.25 * needed;
+			_green();
+		}
+
+		Vector center = (pos_min + pos_max) * 0.5;
+		origin = center - Vector(1.0, 1.0, 1.0) * (0.5 * G * h);
+	}
+
+	void _green() {
+		double r_s = PM_SPLIT * h;
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int x = 0; x < M; ++x) {
+			for (int y = 0; y < M; ++y) {
+				for (int z = 0; z < M; ++z) {
+					Vector diff = Vector(std::min(x, M - x), std::min(y, M - y), std::min(z, M - z)) * h;
+					double r = diff.length();
+					double g = (r > 0.0) ? erf(r / (2.0 * r_s)) / r : 1.0 / (sqrt(M_PI) * r_s);
+					green[((size_t)x * M + y) * M + z] = -KAPPA * g;
+				}
+			}
+		}
+		_fft_3d(green.data(), false, M);
+	}
+
+	// Transforms one axis at a time. Only the corner limit^3 is nonzero on the
+	// way in and needed on the way out, so lines outside it along the axes
+	// that are still (or again) spatial are skipped.
+	void _fft_3d(cplx *data, bool inverse, int limit) {
+		for (int pass = 0; pass < 3; ++pass) {
+			int axis = inverse ? pass : 2 - pass;
+			size_t stride = (axis == 2) ? 1 : (axis == 1) ? M : (size_t)M * M;
+
+#ifdef _OPENMP
+			#pragma omp parallel
+#endif
+			{
+				std::vector<cplx> line(M);
+
+#ifdef _OPENMP
+				#pragma omp for schedule(static)
+#endif
+				for (int l = 0; l < M * M; ++l) {
+					int u = l / M, v = l % M;
+					int x = 0, y = 0, z = 0;
+					if (axis == 0) { y = u; z = v; }
+					else if (axis == 1) { x = u; z = v; }
+					else { x = u; y = v; }
+					if ((axis > 0 && x >= limit) || (axis > 1 && y >= limit))
+						continue;
+
+					cplx *base = data + ((size_t)x * M + y) * M + z;
+					for (int k = 0; k < M; ++k)
+						line[k] = base[k * stride];
+					fft(line.data(), M, twiddles.data(), inverse);
+					for (int k = 0; k < M; ++k)
+						base[k * stride] = line[k];
+				}
+			}
+		}
+	}
+
+	// First cell and weights along every axis, returns the cells per axis
+	int _weights(const Vector &pos, int c[3], double w[3][3]) const {
+		double u[3] = {
+			(pos.x - origin.x) / h - 0.5,
+			(pos.y - origin.y) / h - 0.5,
+			(pos.z - origin.z) / h - 0.5
+		};
+		if (assignment == MassAssignment::CIC) {
+			for (int a = 0; a < 3; ++a) {
+				c[a] = (int)floor(u[a]);
+				double f = u[a] - c[a];
+				w[a][0] = 1.0 - f;
+				w[a][1] = f;
+			}
+			return 2;
+		}
+		for (int a = 0; a < 3; ++a) {
+			int i = (int)floor(u[a] + 0.5);
+			double d = u[a] - i;
+			c[a] = i - 1;
+			w[a][0] = 0.5 * (0.5 - d) * (0.5 - d);
+			w[a][1] = 0.75 - d * d;
+			w[a][2] = 0.5 * (0.5 + d) * (0.5 + d);
+		}
+		return 3;
+	}
+
+	// Adds the erfc part of the force of every neighbor within the cutoff,
+	// found through a cell list with cells of the cutoff size
+	void _short_range(int N, const Body *bodies, Vector *accels, const Vector &pos_min, const Vector &pos_max) {
+		double r_s = PM_SPLIT * h;
+		double cutoff = PM_CUTOFF * r_s;
+
+		int cells[3];
+		double extent[3] = { pos_max.x - pos_min.x, pos_max.y - pos_min.y, pos_max.z - pos_min.z };
+		for (int a = 0; a < 3; ++a)
+			cells[a] = std::min((int)(extent[a] / cutoff) + 1, 1024);
+		auto cell_of = [&](const Vector &pos, int c[3]) {
+			c[0] = std::min((int)((pos.x - pos_min.x) / cutoff), cells[0] - 1);
+			c[1] = std::min((int)((pos.y - pos_min.y) / cutoff), cells[1] - 1);
+			c[2] = std::min((int)((pos.z - pos_min.z) / cutoff), cells[2] - 1);
+			return (c[0] * cells[1] + c[1]) * cells[2] + c[2];
+		};
+
+		// Counting sort of the bodies by cell
+		size_t total = (size_t)cells[0] * cells[1] * cells[2];
+		cell_start.assign(total + 1, 0);
+		cell_bodies.resize(N);
+		std::vector<int> body_cell(N);
+		for (int i = 0; i < N; ++i) {
+			int c[3];
+			body_cell[i] = cell_of(bodies[i].pos, c);
+			++cell_start[body_cell[i] + 1];
+		}
+		for (size_t k = 0; k < total; ++k)
+			cell_start[k + 1] += cell_start[k];
+		std::vector<int> fill(cell_start.begin(), cell_start.end() - 1);
+		for (int i = 0; i < N; ++i)
+			cell_bodies[fill[body_cell[i]]++] = i;
+
+		double cutoff2 = cutoff * cutoff;
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic, 64)
+#endif
+		for (int i = 0; i < N; ++i) {
+			int c[3];
+			cell_of(bodies[i].pos, c);
+			Vector accel_sum = Vector();
+			for (int x = std::max(c[0] - 1, 0); x <= std::min(c[0] + 1, cells[0] - 1); ++x)
+				for (int y = std::max(c[1] - 1, 0); y <= std::min(c[1] + 1, cells[1] - 1); ++y)
+					for (int z = std::max(c[2] - 1, 0); z <= std::min(c[2] + 1, cells[2] - 1); ++z) {
+						int k = (x * cells[1] + y) * cells[2] + z;
+						for (int b = cell_start[k]; b < cell_start[k + 1]; ++b) {
+							int j = cell_bodies[b];
+							Vector diff = bodies[i].pos - bodies[j].pos;
+							double r2 = diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
+							if (j == i || r2 >= cutoff2)
+								continue;
+							double r = sqrt(r2);
+							double dist = r + EPS;
+							double t = r / (2.0 * r_s);
+							double s = erfc(t) + 2.0 * t / sqrt(M_PI) * exp(-t * t);
+							accel_sum += diff * (bodies[j].m / (dist * dist * dist) * -KAPPA * s);
+						}
+					}
+			accels[i] += accel_sum;
+		}
+	}
+};
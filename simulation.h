@@ -0,0 +1,395 @@
+#pragma once
+
+// Embeddable simulation. Advances a caller-owned array of bodies in place, so
+// no copies are made: the array is always the current state and can be read
+// or modified between calls to step() (call reset() after modifying it).
+//
+//     Simulation sim(N, bodies);
+//     sim.set_solver(Solver::BARNES_HUT);
+//     sim.set_frame_callback(100, [](Simulation &sim, int frame) { ... });
+//     sim.step(10000);
+
+#include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "vector.h"
+#include "body.h"
+#include "numa.h"
+#include "solvers.h"
+#include "fixed.h"
+
+#define SUBSTEP_SEARCH 2.0  // SUBSTEP: candidate pairs are searched within this many radii
+
+enum class Solver {
+	DIRECT,         // O(N^2), sequential
+	DIRECT_FIXED,   // O(N^2), sequential, kernels specialized for N <= FIXED_MAX_N (others use DIRECT)
+	DIRECT_OPENMP,  // O(N^2), parallel over bodies
+	DIRECT_NEWTON,  // O(N^2 / 2), parallel over tile pairs
+	BARNES_HUT,     // O(N log N), octree
+	PARTICLE_MESH   // O(N + G^3 log G), FFT on a G^3 mesh, plus short-range pairs for P3M
+};
+
+enum class Integrator {
+	TAYLOR,   // x += v dt + a dt^2 / 2, v += a dt (one force evaluation per step)
+	LEAPFROG  // Kick-drift-kick, symplectic (one force evaluation per step)
+};
+
+enum class Encounter {
+	NONE,
+	MERGE,    // Close pairs merge into the lower index, conserving mass and momentum; the other body keeps m = 0
+	SUBSTEP   // Close pairs are integrated with substeps of their mutual force, everything else with one step
+};
+
+class Simulation {
+public:
+	// Called after every interval-th step with the running frame index
+	typedef std::function<void(Simulation &, int)> FrameCallback;
+
+private:
+	int N;
+	Body *bodies;
+	Vector *accels;
+	bool accels_valid = false;
+	std::vector<TreeNode> tree;
+	std::vector<TreeNeighbor> tree_neighbors;
+	ParticleMesh mesh;
+	std::unique_ptr<FixedRunner> fixed;
+	bool single_precision = false;
+	NumaReplicas replicas;
+	bool numa_replicate = false;
+
+	Solver solver = Solver::DIRECT;
+	Integrator integrator = Integrator::TAYLOR;
+	double delta_t = 100000.0;
+	double theta = 1.0;
+
+	Encounter encounter = Encounter::NONE;
+	double encounter_radius = 0.0;
+	int substeps = 16;
+	std::vector<std::pair<int, int>> pairs;  // Close pairs (i < j) of the last force evaluation, or SUBSTEP step
+	std::vector<std::pair<int, int>> candidates;  // SUBSTEP: pairs within SUBSTEP_SEARCH radii
+	std::vector<Vector> close_accels;
+	std::vector<int> close_bodies;  // Bodies in at least one close pair
+	int merges = 0;
+
+	FrameCallback frame_callback;
+	int frame_interval = 0;
+	int frame = 0;
+	long long iteration = 0;
+
+public:
+	// Accelerations are first touched in parallel, like the caller's bodies should be
+	Simulation(int N, Body *bodies) : N(N), bodies(bodies) {
+		accels = alloc_first_touch<Vector>(N);
+	}
+
+	~Simulation() {
+		free_first_touch(accels);
+	}
+
+	Simulation(const Simulation &) = delete;
+	Simulation &operator=(const Simulation &) = delete;
+
+	void set_solver(Solver solver) { this->solver = solver; _init_fixed(); reset(); }
+	void set_integrator(Integrator integrator) { this->integrator = integrator; reset(); }
+	void set_delta_t(double delta_t) { this->delta_t = delta_t; }
+	void set_theta(double theta) { this->theta = theta; reset(); }
+
+	// PARTICLE_MESH only: cells per side (rounded up to a power of two), mass
+	// assignment and whether the short-range correction is added (P3M)
+	void set_mesh(int grid, MassAssignment assignment = MassAssignment::TSC, bool short_range = true) {
+		mesh.init(grid, assignment, short_range);
+		reset();
+	}
+
+	// DIRECT_FIXED only: compute in float instead of double
+	void set_single_precision(bool single) { this->single_precision = single; _init_fixed(); }
+
+	// DIRECT_OPENMP only: read sources from a per-NUMA-node copy
+	void set_numa_replicate(bool replicate) {
+		this->numa_replicate = replicate;
+		if (replicate)
+			replicas.init(N);
+		else
+			replicas.release();
+	}
+
+	// BARNES_HUT only: pairs closer than radius are found during the tree walk
+	// and merged, or integrated with substeps extra steps per step. SUBSTEP
+	// always uses kick-drift-kick: the far force kicks everything for half a
+	// step, the close pairs are advanced in substeps under their mutual force
+	// while the rest drifts, and the far force kicks again. The pairs are
+	// chosen once per step, as those that come closer than radius during it,
+	// and both kicks split off the same pairs.
+	void set_encounters(Encounter encounter, double radius, int substeps = 16) {
+		this->encounter = encounter;
+		this->encounter_radius = radius;
+		this->substeps = substeps;
+		pairs.clear();
+		reset();
+	}
+
+	void set_frame_callback(int interval, FrameCallback callback) {
+		this->frame_interval = interval;
+		this->frame_callback = callback;
+	}
+
+	// Cached accelerations (leapfrog) are stale after the caller modifies bodies
+	void reset() { accels_valid = false; }
+
+	int get_N() const { return N; }
+	Body *get_bodies() { return bodies; }
+	const Vector *get_accelerations() const { return accels; }
+	long long get_iteration() const { return iteration; }
+	double get_time() const { return iteration * delta_t; }
+	const std::vector<std::pair<int, int>> &get_close_pairs() const { return pairs; }
+	int get_merges() const { return merges; }
+
+	void step(int n = 1) {
+		if (fixed) {
+			_step_fixed(n);
+			return;
+		}
+
+		for (int s = 0; s < n; ++s) {
+			if (encounter == Encounter::SUBSTEP && solver == Solver::BARNES_HUT)
+				_step_substep();
+			else if (integrator == Integrator::TAYLOR)
+				_step_taylor();
+			else
+				_step_leapfrog();
+
+			if (frame_callback && frame_interval > 0 && iteration % frame_interval == 0)
+				frame_callback(*this, frame++);
+			++iteration;
+		}
+	}
+
+	// With MERGE encounters, close pairs are merged right after the forces are known
+	void compute_accelerations() {
+		bool search = (encounter != Encounter::NONE && encounter_radius > 0.0);
+		switch (solver) {
+		case Solver::DIRECT:
+		case Solver::DIRECT_FIXED:
+			accels_direct(N, bodies, accels);
+			break;
+		case Solver::DIRECT_OPENMP:
+			if (numa_replicate)
+				accels_direct_numa(N, bodies, accels, replicas);
+			else
+				accels_direct_openmp(N, bodies, accels);
+			break;
+		case Solver::DIRECT_NEWTON:
+			accels_direct_newton(N, bodies, accels);
+			break;
+		case Solver::BARNES_HUT:
+			if (search && encounter == Encounter::SUBSTEP)
+				accels_barnes_hut(N, bodies, accels, theta, tree, SUBSTEP_SEARCH * encounter_radius,
+				                  &candidates, &tree_neighbors);
+			else if (search)
+				accels_barnes_hut(N, bodies, accels, theta, tree, encounter_radius, &pairs, &tree_neighbors);
+			else
+				accels_barnes_hut(N, bodies, accels, theta, tree);
+			break;
+		case Solver::PARTICLE_MESH:
+			accels_particle_mesh(N, bodies, accels, mesh);
+			break;
+		}
+		accels_valid = true;
+
+		if (search && encounter == Encounter::MERGE && solver == Solver::BARNES_HUT)
+			_merge_pairs();
+	}
+
+private:
+	void _init_fixed() {
+		fixed.reset();
+		if (solver == Solver::DIRECT_FIXED)
+			fixed = make_fixed_runner(N, single_precision);
+	}
+
+	// Runs the steps up to the next frame callback at once in the fixed-size
+	// kernels, bodies are only updated for the callbacks and at the end
+	void _step_fixed(int n) {
+		fixed->load(bodies);
+		while (n > 0) {
+			int steps = n;
+			bool callback = frame_callback && frame_interval > 0;
+			if (callback)
+				steps = std::min(n, (int)((frame_interval - iteration % frame_interval) % frame_interval) + 1);
+
+			fixed->run(steps, delta_t, integrator == Integrator::LEAPFROG);
+			n -= steps;
+			iteration += steps - 1;
+
+			if (callback && iteration % frame_interval == 0) {
+				fixed->store(bodies, accels);
+				frame_callback(*this, frame++);
+				fixed->load(bodies);
+			}
+			++iteration;
+		}
+		fixed->store(bodies, accels);
+		accels_valid = true;
+	}
+
+	void _step_taylor() {
+		compute_accelerations();
+
+		double dt = delta_t;
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static) if (solver != Solver::DIRECT)
+#endif
+		for (int i = 0; i < N; ++i) {
+			bodies[i].pos = bodies[i].pos + bodies[i].vel * dt + accels[i] * (0.5 * dt * dt);
+			bodies[i].vel = bodies[i].vel + accels[i] * dt;
+		}
+	}
+
+	void _step_leapfrog() {
+		if (!accels_valid)
+			compute_accelerations();
+
+		double dt = delta_t;
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static) if (solver != Solver::DIRECT)
+#endif
+		for (int i = 0; i < N; ++i) {
+			bodies[i].vel += accels[i] * (0.5 * dt);
+			bodies[i].pos += bodies[i].vel * dt;
+		}
+
+		compute_accelerations();
+
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static) if (solver != Solver::DIRECT)
+#endif
+		for (int i = 0; i < N; ++i)
+			bodies[i].vel += accels[i] * (0.5 * dt);
+	}
+
+	// Pairs are merged in order, so chains of close bodies end up in one body
+	void _merge_pairs() {
+		for (const std::pair<int, int> &pair : pairs) {
+			Body &a = bodies[pair.first];
+			Body &b = bodies[pair.second];
+			if (a.m == 0.0 || b.m == 0.0)
+				continue;
+
+			double m = a.m + b.m;
+			a.pos = (a.pos * a.m + b.pos * b.m) * (1.0 / m);
+			a.vel = (a.vel * a.m + b.vel * b.m) * (1.0 / m);
+			accels[pair.first] = (accels[pair.first] * a.m + accels[pair.second] * b.m) * (1.0 / m);
+			a.m = m;
+			b.m = 0.0;
+			++merges;
+		}
+	}
+
+	// Candidates whose distance, moving with their current relative velocity,
+	// drops below the radius within dt. A pair is then substepped in the step
+	// in which it enters the radius as well as the one in which it leaves, so
+	// switching happens symmetrically in time. Candidates are sorted, so pairs
+	// is too.
+	void _select_pairs(double dt) {
+		double radius2 = encounter_radius * encounter_radius;
+		pairs.clear();
+		for (const std::pair<int, int> &pair : candidates) {
+			const Body &a = bodies[pair.first];
+			const Body &b = bodies[pair.second];
+			Vector diff = a.pos - b.pos;
+			Vector vel = a.vel - b.vel;
+			double vel2 = vel.x * vel.x + vel.y * vel.y + vel.z * vel.z;
+			double t = 0.0;
+			if (vel2 > 0.0)
+				t = std::min(std::max(-(diff.x * vel.x + diff.y * vel.y + diff.z * vel.z) / vel2, 0.0), dt);
+			Vector closest = diff + vel * t;
+			if (closest.x * closest.x + closest.y * closest.y + closest.z * closest.z < radius2)
+				pairs.push_back(pair);
+		}
+	}
+
+	// Mutual accelerations of the given pairs only, computed like the tree
+	// computes them for single bodies. Entries of bodies without a close
+	// neighbor stay zero.
+	void _pair_accels(const std::vector<std::pair<int, int>> &pairs) {
+		if ((int)close_accels.size() != N)
+			close_accels.assign(N, Vector());
+		for (int i : close_bodies)
+			close_accels[i] = Vector();
+
+		close_bodies.clear();
+		for (const std::pair<int, int> &pair : pairs) {
+			close_bodies.push_back(pair.first);
+			close_bodies.push_back(pair.second);
+		}
+		std::sort(close_bodies.begin(), close_bodies.end());
+		close_bodies.erase(std::unique(close_bodies.begin(), close_bodies.end()), close_bodies.end());
+
+		for (const std::pair<int, int> &pair : pairs) {
+			Body &a = bodies[pair.first];
+			Body &b = bodies[pair.second];
+			Vector diff = a.pos - b.pos;
+			double dist = diff.length() + EPS;
+			double s = -KAPPA / (dist * dist * dist);
+			close_accels[pair.first] += diff * (s * b.m);
+			close_accels[pair.second] -= diff * (s * a.m);
+		}
+	}
+
+	void _step_substep() {
+		if (!accels_valid)
+			compute_accelerations();
+
+		double dt = delta_t;
+		double h = dt / substeps;
+
+		// Pairs resolved for the whole step
+		_select_pairs(dt);
+
+		// Half kick with the far force
+		_pair_accels(pairs);
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int i = 0; i < N; ++i)
+			bodies[i].vel += (accels[i] - close_accels[i]) * (0.5 * dt);
+
+		// Everything else drifts for the whole step
+		std::vector<char> is_close(N, 0);
+		for (int i : close_bodies)
+			is_close[i] = 1;
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int i = 0; i < N; ++i)
+			if (!is_close[i])
+				bodies[i].pos += bodies[i].vel * dt;
+
+		// Close pairs in substeps of their mutual force
+		for (int s = 0; s < substeps; ++s) {
+			for (int i : close_bodies) {
+				bodies[i].vel += close_accels[i] * (0.5 * h);
+				bodies[i].pos += bodies[i].vel * h;
+			}
+			_pair_accels(pairs);
+			for (int i : close_bodies)
+				bodies[i].vel += close_accels[i] * (0.5 * h);
+		}
+
+		// New forces and candidates for the next step. The half kick with the
+		// far force splits off the pairs of this step, so every pair gets its
+		// mutual impulse for exactly one step.
+		compute_accelerations();
+		_pair_accels(pairs);
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(static)
+#endif
+		for (int i = 0; i < N; ++i)
+			bodies[i].vel += (accels[i] - close_accels[i]) * (0.5 * dt);
+	}
+};
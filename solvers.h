@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "vector.h"
+#include "body.h"
+#include "octree.h"
+#include "numa.h"
+#include "pm.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Force backends, each one fills accels[0..N) from the current positions
+
+inline void accels_direct(int N, Body *bodies, Vector *accels) {
+	for (int i = 0; i < N; ++i) {
+		Vector accel_sum = Vector();
+		for (int j = 0; j < N; ++j) {
+			if (i != j) {
+				accel_sum += bodies[i].acceleration(bodies[j]);
+			}
+		}
+		accels[i] = accel_sum;
+	}
+}
+
+inline void accels_direct_openmp(int N, Body *bodies, Vector *accels) {
+#ifdef _OPENMP
+	#pragma omp parallel for schedule(static)
+#endif
+	for (int i = 0; i < N; ++i) {
+		Vector accel_sum = Vector();
+		for (int j = 0; j < N; ++j) {
+			if (i != j) {
+				accel_sum += bodies[i].acceleration(bodies[j]);
+			}
+		}
+		accels[i] = accel_sum;
+	}
+}
+
+// Sources are read from a copy on the calling thread's NUMA node
+inline void accels_direct_numa(int N, Body *bodies, Vector *accels, NumaReplicas &replicas) {
+#ifdef _OPENMP
+	#pragma omp parallel
+#endif
+	{
+		Body *sources = replicas.update(bodies);
+
+#ifdef _OPENMP
+		#pragma omp for schedule(static)
+#endif
+		for (int i = 0; i < N; ++i) {
+			Vector accel_sum = Vector();
+			for (int j = 0; j < N; ++j) {
+				if (i != j) {
+					accel_sum += bodies[i].acceleration(sources[j]);
+				}
+			}
+			accels[i] = accel_sum;
+		}
+	}
+}
+
+#define TILE 128
+
+// Interactions between tiles [a0, a1) and [b0, b1), or within a tile if a0 == b0
+inline void tile_accels(Body *bodies, Vector *accels, int a0, int a1, int b0, int b1) {
+	for (int i = a0; i < a1; ++i) {
+		Vector accel_i = Vector();
+		for (int j = (a0 == b0 ? i + 1 : b0); j < b1; ++j) {
+			Vector diff = bodies[i].pos - bodies[j].pos;
+			double dist = diff.length() + EPS;
+			double s = -KAPPA / (dist * dist * dist);
+
+			accel_i += diff * (s * bodies[j].m);
+			accels[j] -= diff * (s * bodies[i].m);
+		}
+		accels[i] += accel_i;
+	}
+}
+
+// Newton's third law: every pair is evaluated once. The tile pairs of the
+// interaction triangle are scheduled in rounds of a round-robin tournament, so
+// within a round every tile is touched by exactly one thread and accelerations
+// need no reduction.
+inline void accels_direct_newton(int N, Body *bodies, Vector *accels) {
+	// A single tile is not worth the rounds
+	if (N <= TILE) {
+		for (int i = 0; i < N; ++i)
+			accels[i] = Vector(0.0, 0.0, 0.0);
+		tile_accels(bodies, accels, 0, N, 0, N);
+		return;
+	}
+
+	int threads = 1;
+#ifdef _OPENMP
+	threads = omp_get_max_threads();
+#endif
+	// Even number of tiles, at least two per thread so every round keeps all
+	// threads busy, but no more tiles than bodies
+	int tiles = std::max(2 * threads, (N + TILE - 1) / TILE);
+	tiles += tiles % 2;
+	if (tiles > N)
+		tiles = N - N % 2;
+
+	// Tile t holds bodies [bound(t), bound(t + 1)), t * N overflows int for large N
+	auto bound = [N, tiles](int t) { return (int)((long long)t * N / tiles); };
+
+#ifdef _OPENMP
+	#pragma omp parallel
+#endif
+	{
+#ifdef _OPENMP
+		#pragma omp for schedule(static)
+#endif
+		for (int i = 0; i < N; ++i)
+			accels[i] = Vector(0.0, 0.0, 0.0);
+
+		// Diagonal tiles
+#ifdef _OPENMP
+		#pragma omp for schedule(static)
+#endif
+		for (int t = 0; t < tiles; ++t)
+			tile_accels(bodies, accels, bound(t), bound(t + 1), bound(t), bound(t + 1));
+
+		// Off-diagonal tiles, tiles - 1 rounds of disjoint pairs (circle method)
+		for (int round = 0; round < tiles - 1; ++round) {
+#ifdef _OPENMP
+			#pragma omp for schedule(static)
+#endif
+			for (int p = 0; p < tiles / 2; ++p) {
+				int a = (p == 0) ? tiles - 1 : (round + p) % (tiles - 1);
+				int b = (p == 0) ? round : (round - p + tiles - 1) % (tiles - 1);
+				tile_accels(bodies, accels, bound(a), bound(a + 1), bound(b), bound(b + 1));
+			}
+		}
+	}
+}
+
+inline void bounding_box(int N, Body *bodies, Vector &pos_min, Vector &pos_max) {
+	pos_min = Vector(bodies[0].pos);
+	pos_max = Vector(pos_min);
+	for (int i = 1; i < N; ++i) {
+		if (bodies[i].pos.x < pos_min.x) pos_min.x = bodies[i].pos.x;
+		else if (bodies[i].pos.x > pos_max.x) pos_max.x = bodies[i].pos.x;
+		if (bodies[i].pos.y < pos_min.y) pos_min.y = bodies[i].pos.y;
+		else if (bodies[i].pos.y > pos_max.y) pos_max.y = bodies[i].pos.y;
+		if (bodies[i].pos.z < pos_min.z) pos_min.z = bodies[i].pos.z;
+		else if (bodies[i].pos.z > pos_max.z) pos_max.z = bodies[i].pos.z;
+	}
+}
+
+// The tree is linearized into nodes (reused between calls) and walked without
+// recursion. With pairs, the walk also collects every pair (i < j) closer than
+// radius, sorted; neighbors then holds the search data of the nodes (reused
+// between calls as well).
+inline void accels_barnes_hut(int N, Body *bodies, Vector *accels, double theta, std::vector<TreeNode> &nodes,
+                       double radius = 0.0, std::vector<std::pair<int, int>> *pairs = nullptr,
+                       std::vector<TreeNeighbor> *neighbors = nullptr) {
+	Vector pos_min, pos_max;
+	bounding_box(N, bodies, pos_min, pos_max);
+
+	Octant *root = new Octant(pos_min, pos_max);
+	for (int i = 0; i < N; ++i)
+		root->insert(&(bodies[i]));
+	root->compute_mass_distribution();
+
+	nodes.clear();
+	if (pairs != nullptr) {
+		neighbors->clear();
+		root->flatten(nodes, theta, neighbors, bodies, radius);
+	} else {
+		root->flatten(nodes, theta);
+	}
+	delete root;
+
+	const TreeNode *tree = nodes.data();
+	int count = nodes.size();
+	if (pairs == nullptr) {
+#ifdef _OPENMP
+		#pragma omp parallel for schedule(dynamic, 64)
+#endif
+		for (int i = 0; i < N; ++i)
+			accels[i] = tree_acceleration(tree, count, bodies[i].pos);
+		return;
+	}
+
+	pairs->clear();
+	double radius2 = radius * radius;
+#ifdef _OPENMP
+	#pragma omp parallel
+#endif
+	{
+		std::vector<std::pair<int, int>> my_pairs;
+
+#ifdef _OPENMP
+		#pragma omp for schedule(dynamic, 64) nowait
+#endif
+		for (int i = 0; i < N; ++i) {
+			accels[i] = tree_acceleration_neighbors(tree, neighbors->data(), count, bodies[i].pos, radius2, [&](int j, double) {
+				if (j > i)
+					my_pairs.push_back(std::make_pair(i, j));
+			});
+		}
+
+#ifdef _OPENMP
+		#pragma omp critical
+#endif
+		pairs->insert(pairs->end(), my_pairs.begin(), my_pairs.end());
+	}
+	std::sort(pairs->begin(), pairs->end());
+}
+
+// Mesh (and for P3M the short-range cell list) reused between calls
+inline void accels_particle_mesh(int N, Body *bodies, Vector *accels, ParticleMesh &mesh) {
+	Vector pos_min, pos_max;
+	bounding_box(N, bodies, pos_min, pos_max);
+	mesh.compute(N, bodies, accels, pos_min, pos_max);
+}
@@ -2,17 +2,79 @@
 
 #include "body.h"
 #include "vector.h"
+#include <stdio.h>
 #include <fstream>
 #include <iostream>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
 
-void read_input(int *N, Body **bodies, Body **bodies_new) {
-	std::ifstream in_file;
+// Binary trajectory format (little-endian), see README
+#define TRAJ_MAGIC "NBTB"
+#define TRAJ_VERSION 1
+#define TRAJ_QUANT 65535.0
+
+// Binary input format (little-endian): magic, version, N, padding, then
+// mass, position and velocity of every body as doubles (same layout as Body)
+#define INPUT_MAGIC "NBIB"
+#define INPUT_VERSION 1
+
+static_assert(sizeof(Body) == 7 * sizeof(double), "Body must be 7 packed doubles");
+
+bool read_input_binary(int *N, Body **bodies, Body **bodies_new) {
+    std::ifstream in_file;
+    in_file.open("data/input.bin", std::ios::binary);
+    if (!in_file.is_open())
+        return false;
+
+    char magic[4];
+    int32_t info[3];
+    in_file.read(magic, 4);
+    in_file.read((char *)info, sizeof(info));
+    if (!in_file || memcmp(magic, INPUT_MAGIC, 4) != 0 || info[0] != INPUT_VERSION || info[1] < 0) {
+        printf("Invalid binary input, falling back to data/input.txt\n");
+        return false;
+    }
+
+    *N = info[1];
+    *bodies = new Body[*N];
+    in_file.read((char *)*bodies, (long long)*N * sizeof(Body));
+    if (!in_file) {
+        printf("Truncated binary input, falling back to data/input.txt\n");
+        delete[] *bodies;
+        *bodies = nullptr;
+        return false;
+    }
+
+    if (bodies_new != nullptr) {
+        *bodies_new = new Body[*N];
+        for (int i = 0; i < *N; ++i)
+            (*bodies_new)[i].m = (*bodies)[i].m;
+    }
+
+    in_file.close();
+    return true;
+}
+
+// data/input.bin (written by generate_data) takes precedence over data/input.txt,
+// the file read is printed. The second buffer is optional, only the masses are
+// copied into it.
+void read_input(int *N, Body **bodies, Body **bodies_new = nullptr) {
+    if (read_input_binary(N, bodies, bodies_new)) {
+        printf("Input: data/input.bin (%d bodies)\n", *N);
+        if (std::ifstream("data/input.txt").is_open())
+            printf("Warning: data/input.txt is ignored, remove data/input.bin to use it\n");
+        return;
+    }
+
+    std::ifstream in_file;
     in_file.open("data/input.txt");
 
     in_file >> *N;
 
     *bodies = new Body[*N];
-    *bodies_new = new Body[*N];
+    if (bodies_new != nullptr)
+        *bodies_new = new Body[*N];
 
     for (int i = 0; i < *N; ++i)
     {
@@ -20,17 +82,52 @@ void read_input(int *N, Body **bodies, Body **bodies_new) {
         in_file >> m >> pos_x >> pos_y >> pos_z >> vel_x >> vel_y >> vel_z;
 
         (*bodies)[i].m = m;
-        (*bodies_new)[i].m = m;
+        if (bodies_new != nullptr)
+            (*bodies_new)[i].m = m;
         (*bodies)[i].pos = Vector(pos_x, pos_y, pos_z);
         (*bodies)[i].vel = Vector(vel_x, vel_y, vel_z);
     }
 
     in_file.close();
+    printf("Input: data/input.txt (%d bodies)\n", *N);
+}
+
+// Ensemble input: number of systems followed by every system in the input
+// format above. All systems need the same number of bodies, stored as bodies[s * N + i].
+bool read_ensemble(int *S, int *N, Body **bodies) {
+    std::ifstream in_file;
+    in_file.open("data/input_ensemble.txt");
+    if (!in_file.is_open())
+        return false;
+
+    in_file >> *S;
+    *N = 0;
+    for (int s = 0; s < *S; ++s)
+    {
+        int n;
+        in_file >> n;
+        if (s == 0) {
+            *N = n;
+            *bodies = new Body[(long long)*S * n];
+        } else if (n != *N) {
+            printf("All systems of an ensemble need the same number of bodies\n");
+            return false;
+        }
+
+        for (int i = 0; i < n; ++i)
+        {
+            Body &b = (*bodies)[(long long)s * n + i];
+            in_file >> b.m >> b.pos.x >> b.pos.y >> b.pos.z >> b.vel.x >> b.vel.y >> b.vel.z;
+        }
+    }
+
+    in_file.close();
+    return true;
 }
 
-void write_output(int N, int FRAMES, Vector *log, Body *bodies) {
+void write_output(int N, int FRAMES, Vector *log, Body *bodies, const char *path = "data/output.txt") {
 	std::ofstream out_file;
-    out_file.open("data/output.txt");
+    out_file.open(path);
     out_file << N << "\n" << FRAMES << "\n";
 	for (int b = 0; b < N; ++b)
 		out_file << bodies[b].m << "\n";
@@ -43,3 +140,91 @@ void write_output(int N, int FRAMES, Vector *log, Body *bodies) {
     }
     out_file.close();
 }
+
+inline long long traj_align8(long long size) {
+    return (size + 7) & ~7LL;
+}
+
+// Magic, version, N, FRAMES, masses, then one offset per frame
+inline long long traj_header_size(int N, int FRAMES) {
+    return traj_align8(16 + 4LL * N) + 8LL * FRAMES;
+}
+
+// Bounding box (2 x 3 floats) followed by 3 quantized coordinates per body
+inline long long traj_frame_size(int N) {
+    return traj_align8(24 + 6LL * N);
+}
+
+inline long long traj_frame_offset(int N, int FRAMES, int frame) {
+    return traj_header_size(N, FRAMES) + frame * traj_frame_size(N);
+}
+
+void traj_write_header(int N, int FRAMES, const float *masses, unsigned char *out) {
+    memset(out, 0, traj_header_size(N, FRAMES));
+    int32_t info[3] = { TRAJ_VERSION, N, FRAMES };
+    memcpy(out, TRAJ_MAGIC, 4);
+    memcpy(out + 4, info, sizeof(info));
+    memcpy(out + 16, masses, 4LL * N);
+
+    uint64_t *offsets = (uint64_t *)(out + traj_align8(16 + 4LL * N));
+    for (int s = 0; s < FRAMES; ++s)
+        offsets[s] = traj_frame_offset(N, FRAMES, s);
+}
+
+// Bounding box is stored as floats, so quantize against the rounded values
+inline void traj_bbox(const Vector &pos_min, const Vector &pos_max, float *bbox) {
+    bbox[0] = (float)pos_min.x; bbox[1] = (float)pos_min.y; bbox[2] = (float)pos_min.z;
+    bbox[3] = (float)pos_max.x; bbox[4] = (float)pos_max.y; bbox[5] = (float)pos_max.z;
+}
+
+inline uint16_t traj_quantize(double v, float lo, float hi) {
+    double range = (double)hi - (double)lo;
+    if (range <= 0.0)
+        return 0;
+    double q = (v - lo) / range * TRAJ_QUANT + 0.5;
+    if (q < 0.0) q = 0.0;
+    if (q > TRAJ_QUANT) q = TRAJ_QUANT;
+    return (uint16_t)q;
+}
+
+inline void traj_encode(const Vector &pos, const float *bbox, uint16_t *out) {
+    out[0] = traj_quantize(pos.x, bbox[0], bbox[3]);
+    out[1] = traj_quantize(pos.y, bbox[1], bbox[4]);
+    out[2] = traj_quantize(pos.z, bbox[2], bbox[5]);
+}
+
+// Frame-major, positions only; several times smaller than the text output
+void write_output_binary(int N, int FRAMES, Vector *log, Body *bodies, const char *path = "data/output.bin") {
+    std::vector<float> masses(N);
+    for (int b = 0; b < N; ++b)
+        masses[b] = (float)bodies[b].m;
+
+    std::vector<unsigned char> header(traj_header_size(N, FRAMES));
+    traj_write_header(N, FRAMES, masses.data(), header.data());
+
+    std::ofstream out_file;
+    out_file.open(path, std::ios::binary);
+    out_file.write((const char *)header.data(), header.size());
+
+    std::vector<unsigned char> frame(traj_frame_size(N), 0);
+    float *bbox = (float *)frame.data();
+    uint16_t *coords = (uint16_t *)(frame.data() + 24);
+    for (int s = 0; s < FRAMES; ++s) {
+        Vector pos_min = log[s * 2];
+        Vector pos_max = pos_min;
+        for (int b = 1; b < N; ++b) {
+            const Vector &p = log[(b * FRAMES + s) * 2];
+            if (p.x < pos_min.x) pos_min.x = p.x;
+            if (p.x > pos_max.x) pos_max.x = p.x;
+            if (p.y < pos_min.y) pos_min.y = p.y;
+            if (p.y > pos_max.y) pos_max.y = p.y;
+            if (p.z < pos_min.z) pos_min.z = p.z;
+            if (p.z > pos_max.z) pos_max.z = p.z;
+        }
+        traj_bbox(pos_min, pos_max, bbox);
+        for (int b = 0; b < N; ++b)
+            traj_encode(log[(b * FRAMES + s) * 2], bbox, coords + 3 * b);
+        out_file.write((const char *)frame.data(), frame.size());
+    }
+    out_file.close();
+}
@@ -40,6 +40,9 @@ class App {
 		}
 		this.numSteps = null;
 		this.numBodies = null;
+		this.numLoaded = 0; // Frames available for playback
+		this.numUploaded = 0; // Frames uploaded to the orbit buffer
+		this.lastUploaded = 0;
 		this.step = 0;
 		this.drawOrbits = true;
 		this.relativeSize = 0.8;
@@ -55,13 +58,12 @@ class App {
 		if (!dataset)
 			dataset = "solar.txt"
 
-		// Read shader source code and data
+		// Read shader source code
 		readFiles([
 				"shaders/sprite.vert", "shaders/sprite.frag",
-				"shaders/line.vert", "shaders/line.frag",
-				"../data/" + dataset
+				"shaders/line.vert", "shaders/line.frag"
 			]).then(contents => {
-			const [vsSource, fsSource, vsLineSrc, fsLineSrc, dataText] = contents;
+			const [vsSource, fsSource, vsLineSrc, fsLineSrc] = contents;
 
 			// Compile program
 			const vs = WEBGL.createShader(this.gl, this.gl.VERTEX_SHADER, vsSource);
@@ -79,8 +81,14 @@ class App {
 			this.uniformsLine = WEBGL.getUniforms(this.gl, this.progLine);
 			this.attribsLine = WEBGL.getAttributes(this.gl, this.progLine);
 
-			// Initialize scene geometry
-			this.initData(dataText);
+			// Binary trajectories are streamed, playback starts with the first frame
+			if (dataset.endsWith(".bin")) {
+				this.streamData("../data/" + dataset);
+			} else {
+				readFiles(["../data/" + dataset]).then(([dataText]) => {
+					this.initData(dataText);
+				});
+			}
 
 			// Start animation
 			window.requestAnimationFrame(() => { this.update(); });
@@ -176,8 +184,14 @@ class App {
 			orbits[i] *= 1.0 / avgPos;
 
 
-		let vbo = this.gl.createBuffer();
-		this.gl.bindBuffer(this.gl.ARRAY_BUFFER, vbo);
+		this.initBuffers(positions, orbits);
+		this.numLoaded = this.numSteps;
+		this.numUploaded = this.numSteps;
+	}
+
+	initBuffers(positions, orbits) {
+		this.vbo = this.gl.createBuffer();
+		this.gl.bindBuffer(this.gl.ARRAY_BUFFER, this.vbo);
 		this.gl.bufferData(this.gl.ARRAY_BUFFER, positions, this.gl.STATIC_DRAW);
 
 		this.vao = this.gl.createVertexArray();
@@ -185,8 +199,8 @@ class App {
 		this.gl.enableVertexAttribArray(this.attribs["aPosSize"]);
 		this.gl.vertexAttribPointer(this.attribs["aPosSize"], 4, this.gl.FLOAT, false, 0, 0);
 
-		let vboOrbits = this.gl.createBuffer();
-		this.gl.bindBuffer(this.gl.ARRAY_BUFFER, vboOrbits);
+		this.vboOrbits = this.gl.createBuffer();
+		this.gl.bindBuffer(this.gl.ARRAY_BUFFER, this.vboOrbits);
 		this.gl.bufferData(this.gl.ARRAY_BUFFER, orbits, this.gl.STATIC_DRAW);
 
 		this.vaoOrbits = this.gl.createVertexArray();
@@ -195,6 +209,145 @@ class App {
 		this.gl.vertexAttribPointer(this.attribs["aPos"], 3, this.gl.FLOAT, false, 0, 0);
 	}
 
+	// Binary trajectory (see README): header with masses and frame offsets,
+	// followed by frames of 16-bit positions quantized to a per-frame bounding box
+	async streamData(url) {
+		const res = await fetch(url);
+		const reader = res.body.getReader();
+
+		let bytes = new Uint8Array(1 << 16);
+		let received = 0;
+		let offsets = null;
+		let frameSize = 0;
+		for (;;) {
+			const { done, value } = await reader.read();
+			if (done)
+				break;
+
+			if (received + value.length > bytes.length) {
+				let grown = new Uint8Array(Math.max(2 * bytes.length, received + value.length));
+				grown.set(bytes.subarray(0, received));
+				bytes = grown;
+			}
+			bytes.set(value, received);
+			received += value.length;
+
+			if (offsets === null) {
+				offsets = this.parseHeader(bytes, received);
+				if (offsets === false) {
+					console.error(url + ": not a binary trajectory");
+					await reader.cancel();
+					return;
+				}
+				if (offsets === null)
+					continue;
+				if (this.numSteps === 0) {  // Nothing to play, skip the rest
+					await reader.cancel();
+					break;
+				}
+
+				// Total size is known now, allocate it once
+				frameSize = align8(24 + 6 * this.numBodies);
+				let total = new Uint8Array(offsets[this.numSteps - 1] + frameSize);
+				total.set(bytes.subarray(0, received));
+				bytes = total;
+			}
+
+			let first = this.numLoaded;
+			while (this.numLoaded < this.numSteps && offsets[this.numLoaded] + frameSize <= received) {
+				this.decodeFrame(bytes, offsets[this.numLoaded], this.numLoaded);
+				++this.numLoaded;
+			}
+			if (this.numLoaded > first) {
+				const N = this.numBodies;
+				this.gl.bindBuffer(this.gl.ARRAY_BUFFER, this.vbo);
+				this.gl.bufferSubData(this.gl.ARRAY_BUFFER, first * N * 16,
+					this.positions, first * N * 4, (this.numLoaded - first) * N * 4);
+			}
+		}
+		console.log("Loaded " + this.numLoaded + " frames (" + received + " bytes)");
+	}
+
+	// Returns the frame offsets, null while the header is incomplete and false
+	// if the data is not a binary trajectory
+	parseHeader(bytes, received) {
+		if (received < 4)
+			return null;
+		const magic = String.fromCharCode(bytes[0], bytes[1], bytes[2], bytes[3]);
+		if (magic !== "NBTB")
+			return false;
+		if (received < 16)
+			return null;
+		const view = new DataView(bytes.buffer);
+		const N = view.getInt32(8, true);
+		const steps = view.getInt32(12, true);
+		const tableStart = align8(16 + 4 * N);
+		if (received < tableStart + 8 * steps)
+			return null;
+
+		this.numBodies = N;
+		this.numSteps = steps;
+
+		this.masses = new Float32Array(N);
+		let maxMass = 0;
+		for (let b = 0; b < N; ++b) {
+			this.masses[b] = view.getFloat32(16 + 4 * b, true);
+			maxMass = Math.max(maxMass, this.masses[b]);
+		}
+		for (let b = 0; b < N; ++b)
+			this.masses[b] *= 1.0 / maxMass;
+
+		let offsets = new Array(steps);
+		for (let s = 0; s < steps; ++s)
+			offsets[s] = Number(view.getBigUint64(tableStart + 8 * s, true));
+
+		this.positions = new Float32Array(N * steps * 4);
+		this.orbits = new Float32Array(N * steps * 3);
+		this.initBuffers(this.positions.byteLength, this.orbits.byteLength);
+		return offsets;
+	}
+
+	decodeFrame(bytes, offset, s) {
+		const N = this.numBodies;
+		const bbox = new Float32Array(bytes.buffer, offset, 6);
+		const coords = new Uint16Array(bytes.buffer, offset + 24, 3 * N);
+
+		let scale = [0, 1, 2].map(k => (bbox[k + 3] - bbox[k]) / 65535.0);
+		let pos = new Float32Array(3 * N);
+		for (let i = 0; i < 3 * N; ++i)
+			pos[i] = bbox[i % 3] + coords[i] * scale[i % 3];
+
+		// Normalize by the first frame, the rest of the data is not known yet
+		if (s == 0) {
+			let avgPos = 0;
+			for (let i = 0; i < 3 * N; ++i)
+				avgPos += Math.abs(pos[i]);
+			avgPos /= 3 * N;
+			this.posScale = avgPos > 0 ? 1.0 / avgPos : 1.0;
+		}
+
+		for (let b = 0; b < N; ++b) {
+			let idx = b * this.numSteps + s;
+			let idxRev = s * N + b;
+			for (let k = 0; k < 3; ++k) {
+				this.positions[idxRev * 4 + k] = pos[b * 3 + k] * this.posScale;
+				this.orbits[idx * 3 + k] = pos[b * 3 + k] * this.posScale;
+			}
+			this.positions[idxRev * 4 + 3] = this.masses[b];
+		}
+	}
+
+	// Orbits are stored per body, so upload newly loaded frames in batches
+	uploadOrbits() {
+		const first = this.numUploaded, last = this.numLoaded;
+		this.gl.bindBuffer(this.gl.ARRAY_BUFFER, this.vboOrbits);
+		for (let b = 0; b < this.numBodies; ++b) {
+			let idx = b * this.numSteps + first;
+			this.gl.bufferSubData(this.gl.ARRAY_BUFFER, idx * 12, this.orbits, idx * 3, (last - first) * 3);
+		}
+		this.numUploaded = last;
+	}
+
 	update() {
 		// Time
 		let t = performance.now() * 0.001;
@@ -207,6 +360,15 @@ class App {
 			this.fps.lastUpdated = t;
 		}
 
+		if (this.numLoaded == 0) {
+			window.requestAnimationFrame(() => { this.update(); });
+			return;
+		}
+		if (this.numUploaded < this.numLoaded && t - this.lastUploaded >= 0.25) {
+			this.uploadOrbits();
+			this.lastUploaded = t;
+		}
+
 		// Uniforms
 		let viewMat = GLM.mat4.create();
 		GLM.mat4.lookAt(viewMat, GLM.vec3.fromValues(
@@ -234,7 +396,7 @@ class App {
 			this.gl.uniformMatrix4fv(this.uniformsLine["uPVMMat"], false, pvmMat);
 		
 			for (let b = 0; b < this.numBodies; ++b)
-				this.gl.drawArrays(this.gl.LINE_STRIP, b * this.numSteps, this.step);
+				this.gl.drawArrays(this.gl.LINE_STRIP, b * this.numSteps, Math.min(this.step, this.numUploaded));
 		}
 
 		// Bodies		
@@ -250,7 +412,7 @@ class App {
 		this.gl.drawArrays(this.gl.POINTS, this.step * this.numBodies, this.numBodies);
 
 
-		this.step = (this.step + 1) % this.numSteps;
+		this.step = (this.step + 1) % this.numLoaded;
 		
 		window.requestAnimationFrame(() => { this.update(); });
 	}
@@ -275,6 +437,10 @@ function readFiles(urls) {
 	return Promise.all(contents);
 }
 
+function align8(size) {
+	return Math.ceil(size / 8) * 8;
+}
+
 function deg2rad(angle) {
 	return angle * Math.PI / 180.0;
 }